@@ -0,0 +1,101 @@
+#include "adc_sampler.hpp"
+#include <algorithm>
+
+bool AdcSampler::begin(int pin)
+{
+  adc_unit_t unit;
+
+  if(adc_continuous_io_to_channel(pin, &unit, &channel) != ESP_OK || unit != ADC_UNIT_1) 
+  {
+    return false;
+  }
+
+  adc_continuous_handle_cfg_t handleConfig = {};
+  handleConfig.max_store_buf_size = frameSize * 4;
+  handleConfig.conv_frame_size = frameSize;
+
+  if(adc_continuous_new_handle(&handleConfig, &handle) != ESP_OK) 
+  {
+    handle = nullptr;
+    return false;
+  }
+
+  adc_digi_pattern_config_t pattern = {};
+  pattern.atten = ADC_ATTEN_DB_12; // same range as analogRead()
+  pattern.channel = channel;
+  pattern.unit = ADC_UNIT_1;
+  pattern.bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+
+  adc_continuous_config_t digitalConfig = {};
+  digitalConfig.pattern_num = 1;
+  digitalConfig.adc_pattern = &pattern;
+  digitalConfig.sample_freq_hz = sampleFrequency;
+  digitalConfig.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+  digitalConfig.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+
+  if(adc_continuous_config(handle, &digitalConfig) != ESP_OK)
+  {
+    end();
+    return false;
+  }
+  return true;
+}
+
+bool AdcSampler::sample(AdcReading &reading, uint32_t settleTime, int numSamples)
+{
+  reading = {};
+  if(handle == nullptr) return false;
+
+  numSamples = std::min(numSamples, maxSamples);
+
+  vTaskDelay(pdMS_TO_TICKS(settleTime)); // mux output settling, converter stopped
+
+  adc_continuous_flush_pool(handle);
+  if(adc_continuous_start(handle) != ESP_OK) return false;
+
+  int collected = 0;
+  uint32_t sum = 0;
+
+  while(collected < numSamples)
+  {
+    uint32_t bytesRead = 0;
+    if(adc_continuous_read(handle, frame, frameSize, &bytesRead, readTimeout) != ESP_OK) break;
+
+    for(uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= bytesRead && collected < numSamples; i += SOC_ADC_DIGI_RESULT_BYTES)
+    {
+      adc_digi_output_data_t *data = (adc_digi_output_data_t*)&frame[i];
+      if(data->type1.channel != channel) continue;
+
+      samples[collected] = data->type1.data;
+      sum += samples[collected];
+      collected++;
+    }
+  }
+  adc_continuous_stop(handle);
+
+  if(collected == 0) return false;
+
+  reading.numSamples = collected;
+  reading.average = sum / collected;
+  reading.median = median(collected);
+
+  return true;
+}
+
+uint16_t AdcSampler::median(int numSamples)
+{
+  std::nth_element(samples, samples + numSamples/2, samples + numSamples);
+  return samples[numSamples/2];
+}
+
+void AdcSampler::end()
+{
+  if(handle == nullptr) return;
+  adc_continuous_deinit(handle);
+  handle = nullptr;
+}
+
+bool AdcSampler::isReady()
+{
+  return handle != nullptr;
+}
@@ -0,0 +1,37 @@
+#ifndef _ADC_SAMPLER_HPP_
+#define _ADC_SAMPLER_HPP_
+
+#include <Arduino.h>
+#include "esp_adc/adc_continuous.h"
+
+typedef struct
+{
+  uint16_t average;
+  uint16_t median;
+  uint16_t numSamples;
+}AdcReading;
+
+// burst sampling of a single ADC1 pin through the continuous (DMA) driver
+class AdcSampler
+{
+  private:
+    static const uint32_t sampleFrequency = 20000; // Hz, lowest rate accepted by the esp32 digital controller
+    static const int maxSamples = 256;
+    static const int frameSize = 256; // bytes per DMA frame
+    static const uint32_t readTimeout = 50; // ms
+
+    adc_continuous_handle_t handle = nullptr;
+    adc_channel_t channel;
+
+    uint8_t frame[frameSize] = {};
+    uint16_t samples[maxSamples] = {};
+
+    uint16_t median(int numSamples);
+  public:
+    bool begin(int pin);
+    bool sample(AdcReading &reading, uint32_t settleTime, int numSamples = maxSamples);
+    void end();
+    bool isReady();
+};
+
+#endif
@@ -2,6 +2,8 @@
 #include "esp32-hal.h"
 #include "api_comm.hpp"
 
+static const char *const payloadKeys[] = {"sensorId", "value", "count", "min", "max", "mean", "stddev", "timestamp"}; // index = PayloadKey
+static const uint8_t numPayloadKeys = sizeof(payloadKeys) / sizeof(payloadKeys[0]);
 
 bool ApiComm::initApiComm(HardwareSerial &serialObj, Credentials &wifiObj, Credentials &apiObj, ApiLinks &links)
 {
@@ -9,328 +11,882 @@ bool ApiComm::initApiComm(HardwareSerial &serialObj, Credentials &wifiObj, Crede
   wifiAuth = &wifiObj;
   apiAuth = &apiObj;
   apiLinks = &links;
+  if(!tokens.begin(serialObj, apiObj, links.linkToAuthenticate)) return false; // logs in as soon as wifi is up
   if(!initWifi()) return false;
-  loadWebTime();
-  if(!tokenUpdate()) return false;
-  return true;
+  return tokens.waitForRenewal(0, tokenRenewalWait); // first login, later ones run ahead of expiry
 }
 
 bool ApiComm::initWifi()
 {
-  WiFi.begin(wifiAuth->login,wifiAuth->password);
-  //serial->println("Conectando");
-  uint64_t initMillis = millis();
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(100);
-    serial->println(".");
-    if(millis() - initMillis > maxWifiReconnectTime) return false;
-  }
-  //serial->println("");
-  //serial->print("Conectado à rede WiFi com o endereço IP: ");
+  if(!wifi.begin(*wifiAuth)) return false;
+  if(!wifi.waitConnected(maxWifiReconnectTime)) return false; // keeps joining in the background
   serial->println(WiFi.localIP());
   return true;
 }
 
 bool ApiComm::checkAndReconnectWiFi()
 {
-  if (WiFi.status() != WL_CONNECTED) 
+  if (!wifi.isConnected()) 
   {
     serial->println("ReconnectWiFi");
-    if(!initWifi()) return false;
+    wifi.reconnectNow();
+    return false;
   }
   return true;
 }
+
+bool ApiComm::waitForWiFi(uint32_t timeout)
+{
+  return wifi.waitConnected(timeout);
+}
+
 void ApiComm::turnOffWifi()
 {
-  WiFi.disconnect(true);
-  WiFi.mode(WIFI_OFF);
+  connections.closeAll();
+  wifi.turnOff();
 }
 
-bool ApiComm::httpPost(String &link, String &data)
+bool ApiComm::wakeRadio(uint32_t timeout)
 {
-  HTTPClient http;
+  uint32_t initMillis = millis();
 
-  uint64_t initMillis = millis();
-  int responseCode = -1;
+  wifi.turnOn();
+  if(!wifi.waitConnected(timeout)) return false;
 
-  http.begin(link);
-  http.setConnectTimeout(10000);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("Authorization", token.c_str());
+  uint32_t elapsed = millis() - initMillis;
+  return tokens.waitValid(elapsed < timeout ? timeout - elapsed : 0); // token task logs in as soon as the link is up
+}
 
-  while(1)
-  {
-    responseCode = http.POST(data);
+bool ApiComm::isRadioOn()
+{
+  return wifi.isRadioOn();
+}
 
-    if(responseCode == 401 || responseCode == 403) 
-    {
-      tokenUpdate(true);
-    }
+void ApiComm::setModemSleep(bool enabled)
+{
+  wifi.setModemSleep(enabled);
+}
 
-    if (responseCode == 201)
-    {
-      http.end(); 
-      return true;
-    }
+uint32_t ApiComm::getRadioOnTime()
+{
+  return wifi.getRadioOnTime();
+}
 
-    if(responseCode != -1) 
-    {
-      break;
-    }
+uint32_t ApiComm::getWifiReconnectCount()
+{
+  return wifi.getReconnectCount();
+}
 
-    if(millis()-initMillis> maxReconnectTime) 
-    {
-      break;
-    }
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
+uint32_t ApiComm::getWifiLatency()
+{
+  return wifi.getAverageLatency();
+}
+
+String& ApiComm::linkOf(ApiEndpoint endpoint)
+{
+  switch(endpoint)
+  {
+    case ENDPOINT_AUTHENTICATE:
+      return apiLinks->linkToAuthenticate;
+    case ENDPOINT_SENSORS_READING:
+      return apiLinks->linkToSensorsReading;
+    case ENDPOINT_VALVE_STATE:
+      return apiLinks->linkToValveState;
+    case ENDPOINT_TIME_VALVE:
+      return apiLinks->linkToTimeValve;
+    default:
+      return apiLinks->linkToWaterFlow;
   }
-  http.end();
-  return false;
 }
 
-String ApiComm::httpGet(String &link)
+bool ApiComm::isConnectionError(int responseCode, const char *method)
 {
-  int responseCode = -1;
-  uint64_t initMillis = millis();
+  // nothing reached the server, safe to send again whatever the method
+  if(responseCode == HTTPC_ERROR_CONNECTION_REFUSED || responseCode == HTTPC_ERROR_SEND_HEADER_FAILED) return true;
 
-  HTTPClient http;
+  // the body may already be stored, only a GET goes again
+  return strcmp(method, "GET") == 0 && (responseCode == HTTPC_ERROR_SEND_PAYLOAD_FAILED ||
+         responseCode == HTTPC_ERROR_CONNECTION_LOST || responseCode == HTTPC_ERROR_READ_TIMEOUT);
+}
 
-  http.begin(link);
-  http.setConnectTimeout(10000);
-  http.addHeader("Content-Type", "application/json");
-  http.addHeader("Authorization", token.c_str());
+bool ApiComm::isServerFailure(int responseCode)
+{
+  return responseCode < 0 || responseCode >= 500; // 4xx means the server answered
+}
 
-  while(1)
-  {
-    //serial->println(">Buscando Estado Valvula<");
-    int responseCode = http.GET();
+bool ApiComm::isOnline()
+{
+  return wifi.isConnected() && tokens.isValid();
+}
 
-    //serial->print("responseCode: ");
-    //serial->println(responseCode);
+bool ApiComm::isEndpointReady(ApiEndpoint endpoint)
+{
+  return requestEngine.timeUntilReady(endpoint, millis()) == 0;
+}
 
-    if(responseCode == 401 || responseCode == 403) 
-    {
-      tokenUpdate(true);
-    }
+int ApiComm::sendRequest(HTTPClient *&http, ApiEndpoint endpoint, const char *method, const char *data, size_t length, PayloadFormat format)
+{
+  uint32_t requestStart = millis();
+  bool reused = http->connected(); // kept-alive socket from an earlier request
+  int responseCode = http->sendRequest(method, (uint8_t*)data, length);
 
-    if (responseCode == 200) 
-    {
-      String payload = http.getString();
-      http.end(); 
-      return payload; 
-    }
+  if(reused && isConnectionError(responseCode, method)) // server closed the kept-alive socket, reconnect once
+  {
+    connections.drop(http);
+    http = connections.acquire(linkOf(endpoint));
+    if(http == nullptr) return HTTPC_ERROR_CONNECTION_REFUSED;
+    addRequestHeaders(*http, endpoint, format); // end() cleared every header of the first attempt
+    if(strcmp(method, "GET") == 0) addValidatorHeaders(*http, endpoint); // stays a conditional GET
+    responseCode = http->sendRequest(method, (uint8_t*)data, length);
+  }
 
-    if(millis()-initMillis > maxReconnectTime) 
-    {
-      break;
-    }
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
+  if(isServerFailure(responseCode)) 
+  {
+    requestEngine.failed(endpoint, millis());
+    if(requestEngine.getState(endpoint) == REQUEST_OPEN) serial->println("circuitOpen");
+  }
+  else
+  {
+    requestEngine.succeeded(endpoint);
   }
-  http.end(); 
-  return defaultResponse;
+
+  uint32_t latency = millis() - requestStart;
+  EndpointStats &stats = endpointStats[endpoint];
+  stats.requests++;
+  stats.lastLatency = latency;
+  stats.averageLatency = (stats.requests == 1) ? latency : (stats.averageLatency * 7 + latency) / 8;
+
+  serial->print("latency:"); // debug
+  serial->println(latency); // debug
+  return responseCode;
+}
+
+uint32_t ApiComm::addRequestHeaders(HTTPClient &http, ApiEndpoint endpoint, PayloadFormat format)
+{
+  http.addHeader("Content-Type", format == PAYLOAD_CBOR ? "application/cbor" : "application/json");
+  if(endpoint == ENDPOINT_AUTHENTICATE) return 0;
+
+  uint32_t tokenGeneration = tokens.copyToken(authorizationHeader, sizeof(authorizationHeader));
+  http.addHeader("Authorization", authorizationHeader);
+  return tokenGeneration;
 }
 
+bool ApiComm::isAuthRejected(int responseCode)
+{
+  return responseCode == 401 || responseCode == 403;
+}
 
-bool ApiComm::tokenUpdate(bool ignoreTimeTokenUpdade)
+bool ApiComm::renewToken(uint32_t rejectedGeneration)
 {
-  static bool isFirstFunctionCall = true;
-  
-  if(!isFirstFunctionCall)
+  serial->println("apiTokenRejected");
+  tokens.invalidate(rejectedGeneration);
+  return tokens.waitForRenewal(rejectedGeneration, tokenRenewalWait);
+}
+
+int ApiComm::postOnce(ApiEndpoint endpoint, const char *data, size_t length, PayloadFormat format, uint32_t &tokenGeneration)
+{
+  HTTPClient *http = connections.acquire(linkOf(endpoint));
+  if(http == nullptr) return HTTPC_ERROR_CONNECTION_REFUSED;
+
+  tokenGeneration = addRequestHeaders(*http, endpoint, format);
+
+  int responseCode = sendRequest(http, endpoint, "POST", data, length, format);
+  if(http == nullptr) return responseCode;
+
+  connections.release(http);
+  return responseCode;
+}
+
+bool ApiComm::httpPost(ApiEndpoint endpoint, const char *data, size_t length, PayloadFormat format)
+{
+  int responseCode;
+  return httpPost(endpoint, data, length, format, responseCode);
+}
+
+bool ApiComm::httpPost(ApiEndpoint endpoint, const char *data, size_t length, PayloadFormat format, int &responseCode)
+{
+  responseCode = 0;
+  if(!requestEngine.ready(endpoint, millis())) return false; // backing off, caller queues or retries later
+
+  uint32_t tokenGeneration = 0;
+  responseCode = postOnce(endpoint, data, length, format, tokenGeneration);
+
+  if(isAuthRejected(responseCode) && renewToken(tokenGeneration)) // exactly one retry with the renewed token
   {
-    uint64_t currentMillis = millis();
-    if(!(currentMillis-lastMillisTokenUpdate >= timeTokenUpdade) || !ignoreTimeTokenUpdade)
-    { 
-      return true;
-    }
+    responseCode = postOnce(endpoint, data, length, format, tokenGeneration);
   }
 
-  if (WiFi.status() != WL_CONNECTED) 
+  if(responseCode == 415 && format == PAYLOAD_CBOR) // server does not take cbor, json from now on
   {
-    return false;
+    formatRejected[endpoint] = true;
+    serial->println("cborRejected");
   }
 
-  DynamicJsonDocument loginApi(128);
+  return responseCode == 201;
+}
+
+void ApiComm::addValidatorHeaders(HTTPClient &http, ApiEndpoint endpoint)
+{
+  const char *headerKeys[] = {"ETag", "Last-Modified"};
+  const size_t headerKeysCount = sizeof(headerKeys) / sizeof(headerKeys[0]);
 
-  loginApi["username"] = apiAuth->login;
-  loginApi["password"] = apiAuth->password;
+  http.collectHeaders(headerKeys, headerKeysCount); // pooled client, set again on every request
 
-  String jsonStringAuth;
-  serializeJson(loginApi, jsonStringAuth);
-  jsonStringAuth.trim();
+  EndpointValidators &cache = validators[endpoint];
+  if(cache.etag[0] != '\0') http.addHeader("If-None-Match", cache.etag);
+  if(cache.lastModified[0] != '\0') http.addHeader("If-Modified-Since", cache.lastModified);
+}
 
-  HTTPClient http;
+void ApiComm::storeValidators(HTTPClient &http, ApiEndpoint endpoint)
+{
+  EndpointValidators &cache = validators[endpoint];
 
-  uint64_t initMillis = millis();
-  int responseCode = -1;
+  strlcpy(cache.etag, http.header("ETag").c_str(), sizeof(cache.etag));
+  strlcpy(cache.lastModified, http.header("Last-Modified").c_str(), sizeof(cache.lastModified));
+}
 
-  while(1)
+void ApiComm::forceRefresh(ApiEndpoint endpoint)
+{
+  validators[endpoint] = {};
+}
+
+HTTPClient* ApiComm::getOnce(ApiEndpoint endpoint, bool streamBody, int &responseCode, uint32_t &tokenGeneration)
+{
+  responseCode = HTTPC_ERROR_CONNECTION_REFUSED;
+
+  HTTPClient *http = connections.acquire(linkOf(endpoint));
+  if(http == nullptr) return nullptr;
+
+  http->useHTTP10(streamBody); // no chunked encoding when the body is parsed from the stream
+  tokenGeneration = addRequestHeaders(*http, endpoint);
+  addValidatorHeaders(*http, endpoint);
+
+  responseCode = sendRequest(http, endpoint, "GET", nullptr, 0);
+  if(http == nullptr) return nullptr;
+
+  if (responseCode == 200) 
   {
-    http.begin(apiLinks->linkToAuthenticate);
-    http.setConnectTimeout(10000);
-    http.addHeader("Content-Type", "application/json");
+    return http; 
+  }
 
-    const char *headerKeys[] = {"Authorization"};
-    const size_t headerKeysCount = sizeof(headerKeys) / sizeof(headerKeys[0]);
-    
-    http.collectHeaders(headerKeys, headerKeysCount);
+  closeGet(http);
+  return nullptr;
+}
 
-    responseCode = http.POST(jsonStringAuth);
+HTTPClient* ApiComm::openGet(ApiEndpoint endpoint, bool streamBody, bool &notModified)
+{
+  notModified = false;
+  if(!requestEngine.ready(endpoint, millis())) return nullptr;
 
-    if (responseCode == 200) 
-    {
-      String payload = http.getString(); 
-      token = http.header("Authorization");
-      http.end();
-      lastMillisTokenUpdate = millis();
-      isFirstFunctionCall = false;
-      serial->println("apiTokenOK");
-      return true;
-    }
-    if(responseCode != -1) break;
+  int responseCode;
+  uint32_t tokenGeneration = 0;
+  HTTPClient *http = getOnce(endpoint, streamBody, responseCode, tokenGeneration);
+
+  if(isAuthRejected(responseCode) && renewToken(tokenGeneration)) // exactly one retry with the renewed token
+  {
+    http = getOnce(endpoint, streamBody, responseCode, tokenGeneration);
+  }
+
+  notModified = responseCode == 304; // no body, caller keeps what it has
+  return http;
+}
+
+void ApiComm::closeGet(HTTPClient *http)
+{
+  if(http == nullptr) return;
+  connections.release(http); // an HTTP/1.0 exchange is not reused, the socket closes here
+  http->useHTTP10(false);
+}
+
+String ApiComm::httpGet(ApiEndpoint endpoint, bool &notModified)
+{
+  HTTPClient *http = openGet(endpoint, false, notModified);
+  if(http == nullptr) return defaultResponse;
+
+  String payload = http->getString();
+  storeValidators(*http, endpoint);
+  closeGet(http);
+  return payload;
+}
+
+uint32_t ApiComm::getLatency(ApiEndpoint endpoint)
+{
+  return endpointStats[endpoint].averageLatency;
+}
 
-    if(millis()-initMillis> maxReconnectTime) 
+uint32_t ApiComm::getTokenRefreshCount()
+{
+  return tokens.getRefreshCount();
+}
+
+bool ApiComm::sendAllSensorsData(Sensor humi[], Sensor temp[], size_t sizeArrayHumi, size_t sizeArrayTemp, const bool includeHumi[], const bool includeTemp[])
+{
+  return postSensors(humi, temp, nullptr, nullptr, sizeArrayHumi, sizeArrayTemp, includeHumi, includeTemp);
+}
+
+bool ApiComm::sendAggregatedSensorsData(Sensor humi[], Sensor temp[], WindowAggregate aggregateHumi[], WindowAggregate aggregateTemp[], size_t sizeArrayHumi, size_t sizeArrayTemp, const bool includeHumi[], const bool includeTemp[])
+{
+  return postSensors(humi, temp, aggregateHumi, aggregateTemp, sizeArrayHumi, sizeArrayTemp, includeHumi, includeTemp);
+}
+
+void ApiComm::writeSensorObject(JsonBufferWriter &json, Sensor &reading, WindowAggregate *aggregate, const uint32_t *timestamp)
+{
+  json.beginObject();
+  json.key("sensorId");
+  json.value(reading.id);
+  json.key("value");
+  json.value(reading.sensorValue);
+
+  if(aggregate != nullptr)
+  {
+    json.key("count");
+    json.value(aggregate->count());
+    if(aggregate->count() > 0)
     {
-      break;
+      json.key("min");
+      json.value(aggregate->minimum());
+      json.key("max");
+      json.value(aggregate->maximum());
+      json.key("mean");
+      json.value(aggregate->mean());
+      json.key("stddev");
+      json.value(aggregate->stddev(), 3);
     }
-    delay(20);
   }
-  http.end();
-  return false;
+
+  if(timestamp != nullptr)
+  {
+    json.key("timestamp");
+    json.value(*timestamp);
+  }
+  json.endObject();
 }
 
-bool ApiComm::sendAllSensorsData(Sensor humi[], Sensor temp[], size_t sizeArrayHumi, size_t sizeArrayTemp)
+void ApiComm::writeSensorObject(CborBufferWriter &cbor, Sensor &reading, WindowAggregate *aggregate, const uint32_t *timestamp)
 {
-  if (WiFi.status() != WL_CONNECTED) 
+  uint32_t numFields = 2;
+  if(aggregate != nullptr) numFields += (aggregate->count() > 0) ? 5 : 1;
+  if(timestamp != nullptr) numFields++;
+
+  cbor.beginMap(numFields);
+  cbor.key(PAYLOAD_KEY_SENSOR_ID);
+  cbor.value(reading.id);
+  cbor.key(PAYLOAD_KEY_VALUE);
+  cbor.value(reading.sensorValue);
+
+  if(aggregate != nullptr)
   {
-    return false;
+    cbor.key(PAYLOAD_KEY_COUNT);
+    cbor.value(aggregate->count());
+    if(aggregate->count() > 0)
+    {
+      cbor.key(PAYLOAD_KEY_MIN);
+      cbor.value(aggregate->minimum());
+      cbor.key(PAYLOAD_KEY_MAX);
+      cbor.value(aggregate->maximum());
+      cbor.key(PAYLOAD_KEY_MEAN);
+      cbor.value(aggregate->mean());
+      cbor.key(PAYLOAD_KEY_STDDEV);
+      cbor.value(aggregate->stddev());
+    }
   }
 
-  if(!tokenUpdate()) 
-  { 
-    return false;
+  if(timestamp != nullptr)
+  {
+    cbor.key(PAYLOAD_KEY_TIMESTAMP);
+    cbor.value(*timestamp);
   }
+}
 
-  size_t jsonArraySize = sizeArrayTemp + sizeArrayHumi;
-  const size_t capacity = JSON_ARRAY_SIZE(jsonArraySize) + jsonArraySize * JSON_OBJECT_SIZE(2);
-
-  DynamicJsonDocument dataSensors(capacity);
-  JsonArray sensorsArray = dataSensors.to<JsonArray>();
+size_t ApiComm::encodeSensors(PayloadFormat format, Sensor humi[], Sensor temp[], WindowAggregate aggregateHumi[], WindowAggregate aggregateTemp[], size_t sizeArrayHumi, size_t sizeArrayTemp, const bool includeHumi[], const bool includeTemp[], const uint32_t *timestamp)
+{
+  JsonBufferWriter json(payloadBuffer, sizeof(payloadBuffer));
+  CborBufferWriter cbor((uint8_t*)payloadBuffer, sizeof(payloadBuffer));
+  bool binary = format == PAYLOAD_CBOR;
 
+  // one-byte open/close in both formats ('[' ']' and 0x9f 0xff), queue records keep only the items
+  binary ? cbor.beginArray() : json.beginArray();
   for (int i = 0; i < sizeArrayTemp; i++) 
   { 
-    JsonObject sensor = sensorsArray.createNestedObject(); 
-    sensor["sensorId"] = temp[i].id; 
-    sensor["value"] = temp[i].sensorValue;
+    if(includeTemp != nullptr && !includeTemp[i]) continue;
+    WindowAggregate *aggregate = aggregateTemp == nullptr ? nullptr : &aggregateTemp[i];
+    binary ? writeSensorObject(cbor, temp[i], aggregate, timestamp) : writeSensorObject(json, temp[i], aggregate, timestamp);
   }
 
   for (int i = 0; i < sizeArrayHumi; i++) 
   { 
-    JsonObject sensor = sensorsArray.createNestedObject(); 
-    sensor["sensorId"] = humi[i].id; 
-    sensor["value"] = humi[i].sensorValue;
+    if(includeHumi != nullptr && !includeHumi[i]) continue;
+    WindowAggregate *aggregate = aggregateHumi == nullptr ? nullptr : &aggregateHumi[i];
+    binary ? writeSensorObject(cbor, humi[i], aggregate, timestamp) : writeSensorObject(json, humi[i], aggregate, timestamp);
   }
+  binary ? cbor.endArray() : json.endArray();
 
-  String jsonStringdataSensors;
-  serializeJson(dataSensors, jsonStringdataSensors);
-  jsonStringdataSensors.trim();
+  if(binary) return cbor.ok() ? cbor.length() : 0;
+  return json.ok() ? json.length() : 0;
+}
+
+bool ApiComm::postSensors(Sensor humi[], Sensor temp[], WindowAggregate aggregateHumi[], WindowAggregate aggregateTemp[], size_t sizeArrayHumi, size_t sizeArrayTemp, const bool includeHumi[], const bool includeTemp[])
+{
+  size_t length;
 
-  return httpPost(apiLinks->linkToSensorsReading , jsonStringdataSensors);
+  if(mqtt != nullptr && mqtt->isConnected())
+  {
+    length = encodeSensors(PAYLOAD_JSON, humi, temp, aggregateHumi, aggregateTemp, sizeArrayHumi, sizeArrayTemp, includeHumi, includeTemp, nullptr);
+    if(length > 0 && mqtt->publish("sensors", payloadBuffer, length)) return true;
+  }
+
+  PayloadFormat format = formatOf(ENDPOINT_SENSORS_READING);
+  length = encodeSensors(format, humi, temp, aggregateHumi, aggregateTemp, sizeArrayHumi, sizeArrayTemp, includeHumi, includeTemp, nullptr);
+  if(length == 0)
+  {
+    serial->println("sensorsPayload_overflow");
+    return false;
+  }
+
+  if (wifi.isConnected() && tokens.isValid() && httpPost(ENDPOINT_SENSORS_READING, payloadBuffer, length, format))
+  {
+    return true;
+  }
+
+  if(format != formatOf(ENDPOINT_SENSORS_READING)) // cbor refused, same readings as json right away
+  {
+    format = PAYLOAD_JSON;
+    length = encodeSensors(format, humi, temp, aggregateHumi, aggregateTemp, sizeArrayHumi, sizeArrayTemp, includeHumi, includeTemp, nullptr);
+    if(length > 0 && httpPost(ENDPOINT_SENSORS_READING, payloadBuffer, length, format)) return true;
+  }
+
+  uint32_t timestamp = currentTimestamp();
+  length = encodeSensors(format, humi, temp, aggregateHumi, aggregateTemp, sizeArrayHumi, sizeArrayTemp, includeHumi, includeTemp, &timestamp);
+  if(length > 2)
+  {
+    // records hold the items, batches add the brackets
+    return enqueueUpload(format == PAYLOAD_CBOR ? QUEUE_RECORD_SENSORS_CBOR : QUEUE_RECORD_SENSORS, timestamp, payloadBuffer + 1, length - 2);
+  }
+
+  return false;
+}
+
+PayloadFormat ApiComm::formatOf(ApiEndpoint endpoint)
+{
+  PayloadFormat configured = PAYLOAD_JSON;
+
+  if(endpoint == ENDPOINT_SENSORS_READING) configured = apiLinks->sensorsFormat;
+  if(endpoint == ENDPOINT_WATER_FLOW) configured = apiLinks->waterFlowFormat;
+
+  return formatRejected[endpoint] ? PAYLOAD_JSON : configured;
 }
 
 int ApiComm::getValveState()
 {
-  if (WiFi.status() != WL_CONNECTED) 
+  if (!wifi.isConnected()) 
   {
     return -1;
   }
   
-  if(!tokenUpdate()) 
+  if(!tokens.isValid()) // login runs in the token task
   { 
     return -1;
   }
 
-  String payload = httpGet(apiLinks->linkToValveState);
+  bool notModified;
+  String payload = httpGet(ENDPOINT_VALVE_STATE, notModified);
+
+  if(notModified)
+  {
+    return lastValveState;
+  }
 
+  lastValveState = -1;
   if(payload == "true") 
   {
-    return 1;
+    lastValveState = 1;
   }
   if(payload == "false") 
   {
-    return 0;
+    lastValveState = 0;
   }
 
-  return -1;
+  return lastValveState;
 }
-bool ApiComm::searchForIrrigationTime(TimeIrrigation timeIrragation[])
+bool ApiComm::searchForIrrigationTime(TimeIrrigation timeIrragation[], bool &schedulesChanged)
 {
-  if (WiFi.status() != WL_CONNECTED) 
+  schedulesChanged = false;
+
+  if (!wifi.isConnected()) 
   {
     return false;
   }
 
-  if(!tokenUpdate()) 
+  if(!tokens.isValid()) // login runs in the token task
   { 
     return false;
   }
 
-  String payload = httpGet(apiLinks->linkToTimeValve);
+  bool notModified;
+  HTTPClient *http = openGet(ENDPOINT_TIME_VALVE, true, notModified);
+  if(http == nullptr)
+  {
+    return notModified; // 304, stored schedules are current
+  }
 
-  if(payload == defaultResponse)
+  bool parsed = parseIrrigationSchedules(http->getStream(), timeIrragation);
+  if(parsed)
   {
-    return false;
+    storeValidators(*http, ENDPOINT_TIME_VALVE); // a failed parse must not be confirmed by a later 304
+    schedulesChanged = true;
+  }
+  closeGet(http);
+
+  if(!parsed) 
+  {
+    serial->println("irrigationSchedules_parseFail");
+    requestEngine.failed(ENDPOINT_TIME_VALVE, millis()); // truncated body, back off like a dropped connection
+  }
+  return parsed;
+}
+
+int ApiComm::peekToken(Stream &stream)
+{
+  uint32_t initMillis = millis();
+
+  while(millis() - initMillis < stream.getTimeout())
+  {
+    int c = stream.peek();
+    if(c == -1)
+    {
+      vTaskDelay(1);
+      continue;
+    }
+    if(!isspace(c)) return c;
+    stream.read();
   }
+  return -1;
+}
 
+bool ApiComm::parseIrrigationSchedules(Stream &stream, TimeIrrigation timeIrragation[])
+{
+  // only the times and weekday mask of each slot are kept, the array is read one element at a time
+  StaticJsonDocument<64> filter;
+  filter["initialTime"] = true;
+  filter["finalTime"] = true;
+  filter["weekDays"] = true; // optional bitmask, bit 0 = sunday
+
+  StaticJsonDocument<128> slot;
   int i = 0;
-  DynamicJsonDocument doc(1024);
-  deserializeJson(doc, payload);
 
-  for (JsonObject obj : doc.as<JsonArray>()) 
+  if(peekToken(stream) != '[') return false;
+  stream.read();
+
+  if(peekToken(stream) == ']') return true; // no schedules
+
+  while(i < maxIrrigationSlots)
   {
-    if(i>=maxIrrigationSlots) break;
+    DeserializationError error = deserializeJson(slot, stream, DeserializationOption::Filter(filter));
+    if(error) return false;
 
-    String initialTime = obj["initialTime"];
-    String finalTime = obj["finalTime"];
+    if(passStringToTm(timeIrragation[i].initialTime, slot["initialTime"].as<const char*>()) &&
+       passStringToTm(timeIrragation[i].finalTime, slot["finalTime"].as<const char*>(), true))
+    {
+      // equal times are the server's placeholder slot, never a 24 h run
+      timeIrragation[i].enabled = timeIrragation[i].initialTime.tm_hour != timeIrragation[i].finalTime.tm_hour ||
+                                  timeIrragation[i].initialTime.tm_min != timeIrragation[i].finalTime.tm_min;
+      timeIrragation[i].weekDays = (slot["weekDays"] | allWeekDays) & allWeekDays;
+      i++;
+    }
+    else
+    {
+      timeIrragation[i] = {}; // malformed entry, a valid initialTime may already be written
+    }
 
-    passStringToTm(timeIrragation[i].initialTime, initialTime);
-    passStringToTm(timeIrragation[i].finalTime, finalTime);
-    i++;
+    int separator = peekToken(stream);
+    stream.read();
+    if(separator == ']') return true;
+    if(separator != ',') return false;
   }
 
-  return true;
+  return true; // slots full, the rest of the array is not read
+}
+
+size_t ApiComm::encodeWaterVolume(PayloadFormat format, double volumeRead, const uint32_t *timestamp)
+{
+  if(format == PAYLOAD_CBOR)
+  {
+    CborBufferWriter cbor((uint8_t*)payloadBuffer, sizeof(payloadBuffer));
+    cbor.beginMap(timestamp != nullptr ? 2 : 1);
+    cbor.key(PAYLOAD_KEY_VALUE);
+    cbor.value((float)volumeRead);
+    if(timestamp != nullptr)
+    {
+      cbor.key(PAYLOAD_KEY_TIMESTAMP);
+      cbor.value(*timestamp);
+    }
+    return cbor.ok() ? cbor.length() : 0;
+  }
+
+  JsonBufferWriter jsonSensor(payloadBuffer, sizeof(payloadBuffer));
+  jsonSensor.beginObject();
+  jsonSensor.key("value");
+  jsonSensor.value(volumeRead);
+  if(timestamp != nullptr)
+  {
+    jsonSensor.key("timestamp");
+    jsonSensor.value(*timestamp);
+  }
+  jsonSensor.endObject();
+  return jsonSensor.ok() ? jsonSensor.length() : 0;
 }
+
 bool ApiComm::sendWaterVolume(double &volumeRead)
 {
-  if (WiFi.status() != WL_CONNECTED) 
+  size_t length;
+
+  if(mqtt != nullptr && mqtt->isConnected())
   {
+    length = encodeWaterVolume(PAYLOAD_JSON, volumeRead, nullptr);
+    if(length > 0 && mqtt->publish("flow", payloadBuffer, length)) return true;
+  }
+
+  PayloadFormat format = formatOf(ENDPOINT_WATER_FLOW);
+  length = encodeWaterVolume(format, volumeRead, nullptr);
+  if(length == 0)
+  {
+    serial->println("flowPayload_overflow");
     return false;
   }
 
-  if(!tokenUpdate()) 
-  { 
+  if (wifi.isConnected() && tokens.isValid() && httpPost(ENDPOINT_WATER_FLOW, payloadBuffer, length, format))
+  {
+    return true;
+  }
+
+  if(format != formatOf(ENDPOINT_WATER_FLOW)) // cbor refused
+  {
+    format = PAYLOAD_JSON;
+    length = encodeWaterVolume(format, volumeRead, nullptr);
+    if(length > 0 && httpPost(ENDPOINT_WATER_FLOW, payloadBuffer, length, format)) return true;
+  }
+
+  uint32_t timestamp = currentTimestamp();
+  length = encodeWaterVolume(format, volumeRead, &timestamp);
+  if(length > 0) enqueueUpload(format == PAYLOAD_CBOR ? QUEUE_RECORD_WATER_VOLUME_CBOR : QUEUE_RECORD_WATER_VOLUME, timestamp, payloadBuffer, length);
+
+  return false;
+}
+
+size_t ApiComm::encodeFlowEvent(const char *kind, float rate, uint32_t timestamp)
+{
+  JsonBufferWriter jsonEvent(payloadBuffer, sizeof(payloadBuffer));
+  jsonEvent.beginObject();
+  jsonEvent.key("event");
+  jsonEvent.value(kind);
+  jsonEvent.key("rate");
+  jsonEvent.value(rate);
+  jsonEvent.key("timestamp");
+  jsonEvent.value(timestamp);
+  jsonEvent.endObject();
+  return jsonEvent.ok() ? jsonEvent.length() : 0;
+}
+
+bool ApiComm::sendFlowEvent(const char *kind, float rate, uint32_t timestamp)
+{
+  // the "event" key tells it apart from a volume report on the same endpoint
+  size_t length = encodeFlowEvent(kind, rate, timestamp);
+  if(length == 0)
+  {
+    serial->println("flowEventPayload_overflow");
     return false;
   }
 
-  DynamicJsonDocument jsonSensor(128);
-  jsonSensor["value"] = volumeRead;
-  String waterVolume;
-  serializeJson(jsonSensor, waterVolume);
-  waterVolume.trim();
+  if(mqtt != nullptr && mqtt->isConnected() && mqtt->publish("status", payloadBuffer, length)) return true;
+
+  if (wifi.isConnected() && tokens.isValid() && httpPost(ENDPOINT_WATER_FLOW, payloadBuffer, length, PAYLOAD_JSON))
+  {
+    return true;
+  }
+
+  enqueueUpload(QUEUE_RECORD_FLOW_EVENT, timestamp, payloadBuffer, length); // carries its own timestamp already
+  return false;
+}
+
+void ApiComm::attachOfflineQueue(OfflineQueue *queue)
+{
+  offlineQueue = queue;
+}
+
+void ApiComm::attachMqtt(MqttTransport *transport)
+{
+  mqtt = transport;
+}
+
+uint32_t ApiComm::currentTimestamp()
+{
+  time_t now = time(nullptr);
+  return now > minValidEpoch ? now : 0; // 0 -> clock not set yet
+}
+
+bool ApiComm::enqueueUpload(uint8_t type, uint32_t timestamp, const char *items, size_t length)
+{
+  if(offlineQueue == nullptr) return false;
+
+  if(offlineQueue->push(type, timestamp, (const uint8_t*)items, length))
+  {
+    serial->println("uploadQueued");
+    return true;
+  }
+  serial->println("uploadQueue_fail");
+  return false;
+}
+
+bool ApiComm::isPermanentRejection(int responseCode, PayloadFormat format)
+{
+  if(responseCode < 400 || responseCode >= 500) return false;
+  if(isAuthRejected(responseCode) || responseCode == 408 || responseCode == 429) return false; // token, timeout, rate limit
+  return !(responseCode == 415 && format == PAYLOAD_CBOR); // goes again as json
+}
 
-  return httpPost(apiLinks->linkToWaterFlow , waterVolume);
+uint32_t ApiComm::getDroppedUploads()
+{
+  return droppedUploads;
 }
 
-void ApiComm::passStringToTm(struct tm &tmStruct, String &time)
+bool ApiComm::drainOfflineQueue(int maxRecords)
 {
-  tmStruct.tm_hour = time.substring(0, 2).toInt(); //hh:mm:ss  -> ignore second
-  tmStruct.tm_min = time.substring(3, 5).toInt(); 
+  if(offlineQueue == nullptr || offlineQueue->size() == 0) return true;
+  
+  if (!wifi.isConnected()) 
+  {
+    return false;
+  }
+
+  if(!tokens.isValid()) // login runs in the token task
+  { 
+    return false;
+  }
+
+  uint32_t cursor = offlineQueue->readCursor();
+  int drained = 0;
+  bool singleRecord = false; // last batch overflowed the buffer, retry it record by record
+
+  while(drained < maxRecords)
+  {
+    uint8_t type;
+    if(!offlineQueue->peekType(cursor, type)) break;
+
+    bool sensorsRecord = type == QUEUE_RECORD_SENSORS || type == QUEUE_RECORD_SENSORS_CBOR;
+    bool binaryRecord = type == QUEUE_RECORD_SENSORS_CBOR || type == QUEUE_RECORD_WATER_VOLUME_CBOR;
+
+    ApiEndpoint endpoint = ENDPOINT_COUNT;
+    int maxBatch = 1;
+    if(sensorsRecord) 
+    {
+      endpoint = ENDPOINT_SENSORS_READING;
+      maxBatch = singleRecord ? 1 : maxRecords - drained; // sensor endpoint takes an array, merge consecutive records
+    }
+    if(type == QUEUE_RECORD_WATER_VOLUME || type == QUEUE_RECORD_WATER_VOLUME_CBOR || type == QUEUE_RECORD_FLOW_EVENT) endpoint = ENDPOINT_WATER_FLOW;
+
+    // cbor records are sent as they are unless the endpoint refused cbor since they were queued
+    PayloadFormat format = (binaryRecord && endpoint != ENDPOINT_COUNT) ? formatOf(endpoint) : PAYLOAD_JSON;
+    bool binary = format == PAYLOAD_CBOR;
+    size_t growth = (binaryRecord && !binary) ? 4 : 1; // transcoded json is about 3-4x the cbor
+
+    JsonBufferWriter jsonBody(payloadBuffer, sizeof(payloadBuffer));
+    CborBufferWriter cborBody((uint8_t*)payloadBuffer, sizeof(payloadBuffer));
+    int batched = 0;
+    int batchedValid = 0;
+    uint32_t batchCursor = cursor;
+
+    if(sensorsRecord) binary ? cborBody.beginArray() : jsonBody.beginArray();
+
+    while(batched < maxBatch)
+    {
+      uint8_t nextType;
+      QueueRecord record;
+      uint32_t recordCursor = batchCursor;
+      size_t bodyLength = binary ? cborBody.length() : jsonBody.length();
+
+      if(!offlineQueue->peekType(batchCursor, nextType) || nextType != type) break;
+      if(!offlineQueue->read(batchCursor, record, queueBuffer, sizeof(queueBuffer))) break;
+
+      if(record.valid && bodyLength > 1 && bodyLength + record.length * growth + 3 > maxBatchSize)
+      {
+        batchCursor = recordCursor; // next batch
+        break;
+      }
+      batched++;
+      if(!record.valid) continue; // corrupted record, dropped
+      batchedValid++;
+
+      if(binary) cborBody.raw(queueBuffer, record.length);
+      else if(binaryRecord) cborToJson(queueBuffer, record.length, jsonBody, payloadKeys, numPayloadKeys);
+      else jsonBody.raw((const char*)queueBuffer, record.length);
+    }
+
+    if(sensorsRecord) binary ? cborBody.endArray() : jsonBody.endArray();
+
+    size_t bodyLength = binary ? cborBody.length() : jsonBody.length();
+    bool bodyOk = binary ? cborBody.ok() : jsonBody.ok();
+
+    if(!bodyOk && batched > 1) // transcoding grew past the estimate
+    {
+      singleRecord = true;
+      continue;
+    }
+    singleRecord = false;
+
+    if(!bodyOk) // one record alone does not fit
+    {
+      droppedUploads += batchedValid;
+      serial->println("uploadQueue_dropOverflow");
+    }
+    else if(endpoint == ENDPOINT_COUNT) // written by another firmware version, nowhere to post it
+    {
+      droppedUploads += batchedValid;
+      serial->print("uploadQueue_dropUnknown:"); // debug
+      serial->println(type); // debug
+    }
+    else if(bodyLength > 2)
+    {
+      int responseCode;
+      if(!httpPost(endpoint, payloadBuffer, bodyLength, format, responseCode))
+      {
+        if(!isPermanentRejection(responseCode, format))
+        {
+          if(responseCode >= 400 && responseCode < 500) requestEngine.failed(endpoint, millis()); // 4xx alone does not back off
+          return false;
+        }
+        droppedUploads += batchedValid; // the same body would be refused forever
+        serial->print("uploadQueue_dropRejected:"); // debug
+        serial->println(responseCode); // debug
+      }
+    }
+
+    droppedUploads += batched - batchedValid;
+    offlineQueue->consumeUntil(batchCursor);
+    cursor = batchCursor;
+    drained += max(batched, 1);
+  }
+
+  serial->print("uploadQueue:"); // debug
+  serial->println(offlineQueue->size()); // debug
+  serial->print("uploadDropped:"); // debug
+  serial->println(droppedUploads); // debug
+  return true;
 }
 
-void ApiComm::loadWebTime()
+bool ApiComm::passStringToTm(struct tm &tmStruct, const char *time, bool endOfDay)
 {
-  if (WiFi.status() != WL_CONNECTED) 
+  //hh:mm:ss  -> ignore second
+  if(time == nullptr || !isdigit(time[0]) || !isdigit(time[1]) || time[2] != ':' || !isdigit(time[3]) || !isdigit(time[4]))
   {
-    return;
+    return false;
   }
-  configTime(3600*timezone, daysavetime*3600, "time.nist.gov", "0.pool.ntp.org", "1.pool.ntp.org");
+  int hour = (time[0] - '0') * 10 + (time[1] - '0');
+  int minute = (time[3] - '0') * 10 + (time[4] - '0');
+  if(minute > 59 || hour > 24 || (hour == 24 && (!endOfDay || minute != 0)))
+  {
+    return false;
+  }
+  tmStruct.tm_hour = hour;
+  tmStruct.tm_min = minute;
+  return true;
 }
\ No newline at end of file
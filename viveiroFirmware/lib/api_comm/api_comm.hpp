@@ -3,6 +3,15 @@
 
 #include "HardwareSerial.h"
 #include "data_types.hpp"
+#include "sensor_history.hpp"
+#include "offline_queue.hpp"
+#include "connection_manager.hpp"
+#include "json_writer.hpp"
+#include "cbor_writer.hpp"
+#include "request_engine.hpp"
+#include "mqtt_transport.hpp"
+#include "token_manager.hpp"
+#include "wifi_manager.hpp"
 
 #include <WiFi.h>
 #include <HTTPClient.h>
@@ -11,39 +20,120 @@
 
 extern const int maxIrrigationSlots;
 
+typedef struct
+{
+  uint32_t requests;
+  uint32_t lastLatency;    // ms
+  uint32_t averageLatency; // ms, ema 1/8
+}EndpointStats;
+
+typedef enum
+{
+  PAYLOAD_KEY_SENSOR_ID = 0, // cbor map keys, json names in payloadKeys
+  PAYLOAD_KEY_VALUE,
+  PAYLOAD_KEY_COUNT,
+  PAYLOAD_KEY_MIN,
+  PAYLOAD_KEY_MAX,
+  PAYLOAD_KEY_MEAN,
+  PAYLOAD_KEY_STDDEV,
+  PAYLOAD_KEY_TIMESTAMP
+}PayloadKey;
+
+typedef struct
+{
+  char etag[72];
+  char lastModified[40];
+}EndpointValidators; // conditional GET, empty -> unconditional
+
 class ApiComm {
   private:
-    String token;
     Credentials *wifiAuth, *apiAuth;
     ApiLinks *apiLinks;
 
     HardwareSerial *serial;
+    OfflineQueue *offlineQueue = nullptr;
+    MqttTransport *mqtt = nullptr;
+    ConnectionManager connections;
+    RequestEngine requestEngine;
+    TokenManager tokens;
+    WifiManager wifi;
+    EndpointStats endpointStats[ENDPOINT_COUNT] = {};
+    EndpointValidators validators[ENDPOINT_COUNT] = {};
+    uint32_t droppedUploads = 0;
+    int lastValveState = -1; // answer kept for 304
+    bool formatRejected[ENDPOINT_COUNT] = {}; // 415 on a cbor body
 
-    long timezone = -4;
-    byte daysavetime = 1;
+    const unsigned long maxWifiReconnectTime = 30000; // first join at boot
 
-    const unsigned long maxReconnectTime = 60000;
-    const unsigned long maxWifiReconnectTime = 30000;
-
-    const unsigned long timeTokenUpdade = 2700000;
-    unsigned long lastMillisTokenUpdate = 0;
+    static const uint32_t tokenRenewalWait = 10000; // ms, only after the server refused the token
     
     const String defaultResponse = "unresponsive";
+
+    static const size_t maxQueuedPayload = 2048;
+    static const size_t maxBatchSize = 4096;
+    static const time_t minValidEpoch = 1600000000;
+    uint8_t queueBuffer[maxQueuedPayload];
+    char payloadBuffer[maxBatchSize]; // every outgoing body is serialized here
+    char authorizationHeader[1024]; // copy of the token, renewed by another task
   
     bool initWifi();
-    bool tokenUpdate(bool ignoreTimeTokenUpdade = false);   
-    void passStringToTm(struct tm &tmStruct, String &time);
-    bool httpPost(String &link, String &data);
-    String httpGet(String &link);
+    bool isAuthRejected(int responseCode);
+    bool renewToken(uint32_t rejectedGeneration); // single-flight login in the token task, true once a newer token is in place
+    bool passStringToTm(struct tm &tmStruct, const char *time, bool endOfDay = false); // hh 0-23, mm 0-59, endOfDay -> 24:00 too
+    String& linkOf(ApiEndpoint endpoint);
+    bool isConnectionError(int responseCode, const char *method); // true when a resend cannot duplicate the request
+    bool isServerFailure(int responseCode); // counts against the endpoint backoff
+    uint32_t addRequestHeaders(HTTPClient &http, ApiEndpoint endpoint, PayloadFormat format = PAYLOAD_JSON); // token generation sent
+    int sendRequest(HTTPClient *&http, ApiEndpoint endpoint, const char *method, const char *data, size_t length, PayloadFormat format = PAYLOAD_JSON);
+    int postOnce(ApiEndpoint endpoint, const char *data, size_t length, PayloadFormat format, uint32_t &tokenGeneration);
+    bool httpPost(ApiEndpoint endpoint, const char *data, size_t length, PayloadFormat format = PAYLOAD_JSON); // retried once after a 401/403
+    bool httpPost(ApiEndpoint endpoint, const char *data, size_t length, PayloadFormat format, int &responseCode); // 0 while backing off
+    bool isPermanentRejection(int responseCode, PayloadFormat format); // resending the same body cannot succeed
+    PayloadFormat formatOf(ApiEndpoint endpoint);
+    void addValidatorHeaders(HTTPClient &http, ApiEndpoint endpoint);
+    void storeValidators(HTTPClient &http, ApiEndpoint endpoint);
+    HTTPClient* getOnce(ApiEndpoint endpoint, bool streamBody, int &responseCode, uint32_t &tokenGeneration);
+    HTTPClient* openGet(ApiEndpoint endpoint, bool streamBody, bool &notModified); // 200 -> client positioned at the body, release with closeGet
+    void closeGet(HTTPClient *http);
+    String httpGet(ApiEndpoint endpoint, bool &notModified);
+    int peekToken(Stream &stream); // next non-blank char, -1 on timeout
+    bool parseIrrigationSchedules(Stream &stream, TimeIrrigation timeIrragation[]);
+    void writeSensorObject(JsonBufferWriter &json, Sensor &reading, WindowAggregate *aggregate, const uint32_t *timestamp);
+    void writeSensorObject(CborBufferWriter &cbor, Sensor &reading, WindowAggregate *aggregate, const uint32_t *timestamp);
+    // aggregate arrays nullptr -> snapshot, timestamp nullptr -> omitted; payloadBuffer, 0 on overflow
+    size_t encodeSensors(PayloadFormat format, Sensor humi[], Sensor temp[], WindowAggregate aggregateHumi[], WindowAggregate aggregateTemp[], size_t sizeArrayHumi, size_t sizeArrayTemp, const bool includeHumi[], const bool includeTemp[], const uint32_t *timestamp);
+    size_t encodeWaterVolume(PayloadFormat format, double volumeRead, const uint32_t *timestamp); // payloadBuffer, 0 on overflow
+    size_t encodeFlowEvent(const char *kind, float rate, uint32_t timestamp); // json in payloadBuffer, 0 on overflow
+    bool postSensors(Sensor humi[], Sensor temp[], WindowAggregate aggregateHumi[], WindowAggregate aggregateTemp[], size_t sizeArrayHumi, size_t sizeArrayTemp, const bool includeHumi[], const bool includeTemp[]); // true -> posted or queued, false -> the caller keeps the readings
+    uint32_t currentTimestamp();
+    bool enqueueUpload(uint8_t type, uint32_t timestamp, const char *items, size_t length);
   public:
     bool initApiComm(HardwareSerial &serialObj, Credentials &wifiObj, Credentials &apiObj, ApiLinks &links); // serialObj need for DEBUG
-    bool sendAllSensorsData(Sensor humi[], Sensor temp[], size_t sizeArrayHumi, size_t sizeArrayTemp);
+    // include arrays select the channels to post (deadband), nullptr -> all
+    bool sendAllSensorsData(Sensor humi[], Sensor temp[], size_t sizeArrayHumi, size_t sizeArrayTemp, const bool includeHumi[] = nullptr, const bool includeTemp[] = nullptr);
+    bool sendAggregatedSensorsData(Sensor humi[], Sensor temp[], WindowAggregate aggregateHumi[], WindowAggregate aggregateTemp[], size_t sizeArrayHumi, size_t sizeArrayTemp, const bool includeHumi[] = nullptr, const bool includeTemp[] = nullptr);
     int getValveState();
-    bool searchForIrrigationTime(TimeIrrigation timeIrragation[]);
-    void loadWebTime();
+    bool searchForIrrigationTime(TimeIrrigation timeIrragation[], bool &schedulesChanged); // true with schedulesChanged false -> 304
     bool sendWaterVolume(double &volumeRead);
-    bool checkAndReconnectWiFi();
+    bool sendFlowEvent(const char *kind, float rate, uint32_t timestamp); // L/min, epoch s; mqtt status topic, then http, queued when both fail
+    void attachOfflineQueue(OfflineQueue *queue);
+    void attachMqtt(MqttTransport *transport); // sensors and flow are published there while it is connected
+    bool drainOfflineQueue(int maxRecords);
+    bool checkAndReconnectWiFi(); // non-blocking, wakes the reconnect task when the link is down
+    bool waitForWiFi(uint32_t timeout); // ms
     void turnOffWifi();
+    bool wakeRadio(uint32_t timeout); // ms, joins and waits for a valid token, false -> requests of this window will queue
+    bool isRadioOn();
+    void setModemSleep(bool enabled);
+    uint32_t getRadioOnTime(); // ms during the last full hour
+    uint32_t getWifiReconnectCount();
+    uint32_t getWifiLatency(); // ms, join start -> got ip, smoothed
+    uint32_t getLatency(ApiEndpoint endpoint); // ms, smoothed
+    bool isOnline(); // link up and a valid token, requests can go out now
+    bool isEndpointReady(ApiEndpoint endpoint); // false while the endpoint is backing off or its circuit is open
+    void forceRefresh(ApiEndpoint endpoint); // next GET without If-None-Match
+    uint32_t getTokenRefreshCount();
+    uint32_t getDroppedUploads(); // queued records the server refused or that no longer fit a request
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,257 @@
+#include "cbor_writer.hpp"
+
+static const uint8_t majorUnsigned = 0;
+static const uint8_t majorNegative = 1;
+static const uint8_t majorArray = 4;
+static const uint8_t majorMap = 5;
+
+static const uint8_t indefiniteArray = 0x9F;
+static const uint8_t breakCode = 0xFF;
+static const uint8_t float32Code = 0xFA;
+
+CborBufferWriter::CborBufferWriter(uint8_t *outputBuffer, size_t bufferSize)
+{
+  buffer = outputBuffer;
+  capacity = bufferSize;
+}
+
+void CborBufferWriter::append(const uint8_t *data, size_t length)
+{
+  if(overflowed) return;
+  if(position + length > capacity)
+  {
+    overflowed = true;
+    return;
+  }
+  memcpy(buffer + position, data, length);
+  position += length;
+}
+
+void CborBufferWriter::append(uint8_t byte)
+{
+  append(&byte, 1);
+}
+
+void CborBufferWriter::head(uint8_t majorType, uint32_t argument)
+{
+  uint8_t bytes[5];
+  size_t size;
+
+  majorType <<= 5;
+  if(argument < 24)
+  {
+    bytes[0] = majorType | argument;
+    size = 1;
+  }
+  else if(argument <= 0xFF)
+  {
+    bytes[0] = majorType | 24;
+    bytes[1] = argument;
+    size = 2;
+  }
+  else if(argument <= 0xFFFF)
+  {
+    bytes[0] = majorType | 25;
+    bytes[1] = argument >> 8;
+    bytes[2] = argument;
+    size = 3;
+  }
+  else
+  {
+    bytes[0] = majorType | 26;
+    bytes[1] = argument >> 24;
+    bytes[2] = argument >> 16;
+    bytes[3] = argument >> 8;
+    bytes[4] = argument;
+    size = 5;
+  }
+  append(bytes, size);
+}
+
+void CborBufferWriter::beginArray()
+{
+  append(indefiniteArray);
+}
+
+void CborBufferWriter::beginArray(uint32_t size)
+{
+  head(majorArray, size);
+}
+
+void CborBufferWriter::endArray()
+{
+  append(breakCode);
+}
+
+void CborBufferWriter::beginMap(uint32_t size)
+{
+  head(majorMap, size);
+}
+
+void CborBufferWriter::key(uint8_t id)
+{
+  head(majorUnsigned, id);
+}
+
+void CborBufferWriter::value(int number)
+{
+  value((long)number);
+}
+
+void CborBufferWriter::value(unsigned int number)
+{
+  value((unsigned long)number);
+}
+
+void CborBufferWriter::value(long number)
+{
+  if(number < 0) head(majorNegative, (uint32_t)(-1 - number));
+  else head(majorUnsigned, (uint32_t)number);
+}
+
+void CborBufferWriter::value(unsigned long number)
+{
+  head(majorUnsigned, (uint32_t)number);
+}
+
+void CborBufferWriter::value(float number)
+{
+  uint32_t bits;
+  memcpy(&bits, &number, sizeof(bits));
+
+  uint8_t bytes[5] = {float32Code, (uint8_t)(bits >> 24), (uint8_t)(bits >> 16), (uint8_t)(bits >> 8), (uint8_t)bits};
+  append(bytes, sizeof(bytes));
+}
+
+void CborBufferWriter::raw(const uint8_t *data, size_t length)
+{
+  append(data, length);
+}
+
+const uint8_t* CborBufferWriter::data()
+{
+  return buffer;
+}
+
+size_t CborBufferWriter::length()
+{
+  return position;
+}
+
+bool CborBufferWriter::ok()
+{
+  return !overflowed;
+}
+
+void CborBufferWriter::reset()
+{
+  position = 0;
+  overflowed = false;
+}
+
+static bool readArgument(const uint8_t *data, size_t length, size_t &position, uint8_t info, uint32_t &argument)
+{
+  size_t size = 0;
+
+  if(info < 24)
+  {
+    argument = info;
+    return true;
+  }
+  if(info == 24) size = 1;
+  if(info == 25) size = 2;
+  if(info == 26) size = 4;
+  if(size == 0 || position + size > length) return false;
+
+  argument = 0;
+  for(size_t i = 0; i < size; i++)
+  {
+    argument = (argument << 8) | data[position++];
+  }
+  return true;
+}
+
+static bool transcodeItem(const uint8_t *data, size_t length, size_t &position, JsonBufferWriter &json, const char *const keyNames[], uint8_t numKeys, int depth)
+{
+  if(position >= length || depth > 4) return false;
+
+  uint8_t initial = data[position++];
+  uint8_t majorType = initial >> 5;
+  uint8_t info = initial & 0x1F;
+  uint32_t argument;
+
+  if(initial == float32Code)
+  {
+    if(position + 4 > length) return false;
+    uint32_t bits = ((uint32_t)data[position] << 24) | ((uint32_t)data[position + 1] << 16) | ((uint32_t)data[position + 2] << 8) | data[position + 3];
+    float number;
+    memcpy(&number, &bits, sizeof(number));
+    position += 4;
+    json.value(number, 3);
+    return true;
+  }
+
+  if(initial == indefiniteArray)
+  {
+    json.beginArray();
+    while(position < length && data[position] != breakCode)
+    {
+      if(!transcodeItem(data, length, position, json, keyNames, numKeys, depth + 1)) return false;
+    }
+    if(position >= length) return false;
+    position++;
+    json.endArray();
+    return true;
+  }
+
+  if(!readArgument(data, length, position, info, argument)) return false;
+
+  switch(majorType)
+  {
+    case majorUnsigned:
+      json.value((unsigned long)argument);
+    return true;
+
+    case majorNegative:
+      json.value(-1 - (long)argument);
+    return true;
+
+    case majorArray:
+      json.beginArray();
+      for(uint32_t i = 0; i < argument; i++)
+      {
+        if(!transcodeItem(data, length, position, json, keyNames, numKeys, depth + 1)) return false;
+      }
+      json.endArray();
+    return true;
+
+    case majorMap:
+      json.beginObject();
+      for(uint32_t i = 0; i < argument; i++)
+      {
+        uint32_t id;
+        if(position >= length || (data[position] >> 5) != majorUnsigned) return false;
+        uint8_t keyInfo = data[position++] & 0x1F;
+        if(!readArgument(data, length, position, keyInfo, id) || id >= numKeys) return false;
+
+        json.key(keyNames[id]);
+        if(!transcodeItem(data, length, position, json, keyNames, numKeys, depth + 1)) return false;
+      }
+      json.endObject();
+    return true;
+
+    default:
+    return false;
+  }
+}
+
+bool cborToJson(const uint8_t *data, size_t length, JsonBufferWriter &json, const char *const keyNames[], uint8_t numKeys)
+{
+  size_t position = 0;
+
+  while(position < length)
+  {
+    if(!transcodeItem(data, length, position, json, keyNames, numKeys, 0)) return false;
+  }
+  return json.ok();
+}
@@ -0,0 +1,46 @@
+#ifndef _CBOR_WRITER_HPP_
+#define _CBOR_WRITER_HPP_
+
+#include <Arduino.h>
+#include "json_writer.hpp"
+
+// append-only CBOR (RFC 8949) encoder into a caller-owned buffer, no heap allocation
+// maps take integer keys, floats are always float32
+class CborBufferWriter
+{
+  private:
+    uint8_t *buffer;
+    size_t capacity;
+    size_t position = 0;
+    bool overflowed = false;
+
+    void append(const uint8_t *data, size_t length);
+    void append(uint8_t byte);
+    void head(uint8_t majorType, uint32_t argument);
+  public:
+    CborBufferWriter(uint8_t *outputBuffer, size_t bufferSize);
+
+    void beginArray();              // indefinite length, closed by endArray
+    void beginArray(uint32_t size);
+    void endArray();
+    void beginMap(uint32_t size);
+
+    void key(uint8_t id);
+    void value(int number);
+    void value(unsigned int number);
+    void value(long number);
+    void value(unsigned long number);
+    void value(float number);
+    void raw(const uint8_t *data, size_t length); // pre-encoded items
+
+    const uint8_t* data();
+    size_t length();
+    bool ok(); // false if the buffer was too small
+    void reset();
+};
+
+// transcodes the subset written above (ints, float32, maps, arrays) back to JSON
+// every top-level item is written to json, map keys are looked up in keyNames
+bool cborToJson(const uint8_t *data, size_t length, JsonBufferWriter &json, const char *const keyNames[], uint8_t numKeys);
+
+#endif
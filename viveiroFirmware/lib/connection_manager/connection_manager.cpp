@@ -0,0 +1,122 @@
+#include "connection_manager.hpp"
+
+bool ConnectionManager::parseUrl(const String &url, String &host, uint16_t &port, bool &secure)
+{
+  int schemeEnd = url.indexOf("://");
+  if(schemeEnd < 0) return false;
+
+  secure = url.substring(0, schemeEnd).equalsIgnoreCase("https");
+  port = secure ? 443 : 80;
+
+  int hostStart = schemeEnd + 3;
+  int hostEnd = url.indexOf('/', hostStart);
+  if(hostEnd < 0) hostEnd = url.length();
+
+  host = url.substring(hostStart, hostEnd);
+  int at = host.indexOf('@'); // user:password@host
+  if(at >= 0) host = host.substring(at + 1);
+
+  int colon = host.indexOf(':');
+  if(colon >= 0)
+  {
+    port = host.substring(colon + 1).toInt();
+    host = host.substring(0, colon);
+  }
+  return host.length() > 0;
+}
+
+HttpConnection* ConnectionManager::find(const String &host, uint16_t port, bool secure)
+{
+  for(int i = 0; i < numConnections; i++)
+  {
+    if(connections[i].port == port && connections[i].secure == secure && connections[i].host == host) return &connections[i];
+  }
+  return nullptr;
+}
+
+WiFiClient& ConnectionManager::clientOf(HttpConnection &connection)
+{
+  if(connection.secure) return connection.secureClient;
+  return connection.plainClient;
+}
+
+HTTPClient* ConnectionManager::acquire(const String &url)
+{
+  String host;
+  uint16_t port;
+  bool secure;
+
+  if(!parseUrl(url, host, port, secure)) return nullptr;
+
+  HttpConnection *connection = find(host, port, secure);
+
+  if(connection == nullptr)
+  {
+    if(numConnections < maxConnections)
+    {
+      connection = &connections[numConnections++];
+    }
+    else
+    {
+      connection = &connections[0]; // least recently used host gives its slot
+      for(int i = 1; i < numConnections; i++)
+      {
+        if(connections[i].lastUse < connection->lastUse) connection = &connections[i];
+      }
+      connection->http.end();
+      clientOf(*connection).stop();
+    }
+    connection->host = host;
+    connection->port = port;
+    connection->secure = secure;
+    connection->connects = 0;
+    if(secure) connection->secureClient.setInsecure(); // no CA configured, same as HTTPClient::begin(url)
+  }
+
+  connection->lastUse = millis();
+  if(!clientOf(*connection).connected()) connection->connects++;
+
+  connection->http.setReuse(true);
+  if(!connection->http.begin(clientOf(*connection), url)) return nullptr;
+  connection->http.setConnectTimeout(connectTimeout);
+
+  return &connection->http;
+}
+
+void ConnectionManager::release(HTTPClient *http)
+{
+  if(http != nullptr) http->end();
+}
+
+void ConnectionManager::drop(HTTPClient *http)
+{
+  for(int i = 0; i < numConnections; i++)
+  {
+    if(&connections[i].http != http) continue;
+
+    connections[i].http.setReuse(false);
+    connections[i].http.end();
+    clientOf(connections[i]).stop();
+  }
+}
+
+void ConnectionManager::closeAll()
+{
+  for(int i = 0; i < numConnections; i++)
+  {
+    connections[i].http.setReuse(false);
+    connections[i].http.end();
+    clientOf(connections[i]).stop();
+  }
+}
+
+uint32_t ConnectionManager::getConnectCount()
+{
+  uint32_t total = 0;
+  
+  for(int i = 0; i < numConnections; i++)
+  {
+    total += connections[i].connects;
+  }
+  return total;
+}
@@ -0,0 +1,42 @@
+#ifndef _CONNECTION_MANAGER_HPP_
+#define _CONNECTION_MANAGER_HPP_
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include <HTTPClient.h>
+
+typedef struct
+{
+  String host;
+  uint16_t port;
+  bool secure;
+  uint32_t lastUse;
+  uint32_t connects; // tcp/tls handshakes
+  WiFiClient plainClient;
+  WiFiClientSecure secureClient;
+  HTTPClient http;
+}HttpConnection;
+
+// keep-alive HTTPClient per API host, shared by every ApiLinks endpoint
+class ConnectionManager
+{
+  private:
+    static const int maxConnections = 2; // a tls session costs ~40 KB of heap
+    static const uint32_t connectTimeout = 10000; // ms
+
+    HttpConnection connections[maxConnections];
+    int numConnections = 0;
+
+    bool parseUrl(const String &url, String &host, uint16_t &port, bool &secure);
+    HttpConnection* find(const String &host, uint16_t port, bool secure);
+    WiFiClient& clientOf(HttpConnection &connection);
+  public:
+    HTTPClient* acquire(const String &url); // begin() on the pooled client, nullptr on bad url
+    void release(HTTPClient *http);         // end(), socket stays open when the server allows it
+    void drop(HTTPClient *http);            // close a stale socket, next request reconnects
+    void closeAll();
+    uint32_t getConnectCount();
+};
+
+#endif
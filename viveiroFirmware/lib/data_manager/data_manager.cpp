@@ -4,108 +4,533 @@ void DataManager::clearNvs()
 {
   nvs_flash_erase();
   nvs_flash_init();
+  numPendingStats = 0; // counted writes went with the erase
 }
 
-bool DataManager::storageIDsData(char masterKey[], Sensor sensor[])
+bool DataManager::openForWrite(const char nameSpace[])
+{
+  strlcpy(openNamespace, nameSpace, sizeof(openNamespace));
+  sessionEntries = 0;
+  sessionBytes = 0;
+  return nvs.begin(nameSpace, false); // false -> write and read
+}
+
+void DataManager::closeWrite()
+{
+  nvs.end();
+  if (sessionEntries > 0) addWriteStats(openNamespace, sessionEntries, sessionBytes);
+}
+
+void DataManager::countWrite(size_t dataLength)
+{
+  // nvs stores 32-byte entries, strings and blobs take one header entry plus their data span
+  uint32_t entries = (dataLength == 0) ? 1 : 1 + (dataLength + nvsEntrySize - 1) / nvsEntrySize;
+
+  sessionEntries += entries;
+  sessionBytes += entries * nvsEntrySize;
+}
+
+bool DataManager::writeInt(const char key[], int32_t value)
+{
+  if (nvs.isKey(key) && nvs.getInt(key) == value) return true;
+  if (nvs.putInt(key, value) != sizeof(int32_t)) return false;
+  countWrite(0);
+  return true;
+}
+
+bool DataManager::writeUInt(const char key[], uint32_t value)
+{
+  if (nvs.isKey(key) && nvs.getUInt(key) == value) return true;
+  if (nvs.putUInt(key, value) != sizeof(uint32_t)) return false;
+  countWrite(0);
+  return true;
+}
+
+bool DataManager::writeUChar(const char key[], uint8_t value)
+{
+  if (nvs.isKey(key) && nvs.getUChar(key) == value) return true;
+  if (nvs.putUChar(key, value) != sizeof(uint8_t)) return false;
+  countWrite(0);
+  return true;
+}
+
+bool DataManager::writeULong64(const char key[], uint64_t value)
+{
+  if (nvs.isKey(key) && nvs.getULong64(key) == value) return true;
+  if (nvs.putULong64(key, value) != sizeof(uint64_t)) return false;
+  countWrite(0);
+  return true;
+}
+
+bool DataManager::writeString(const char key[], const String &value)
+{
+  if (nvs.isKey(key) && nvs.getString(key) == value) return true;
+  if (nvs.putString(key, value) != value.length()) return false;
+  countWrite(value.length() + 1);
+  return true;
+}
+
+bool DataManager::writeBytes(const char key[], const void *value, size_t length)
 {
-  if (!nvs.begin(masterKey, false)) // false -> writing and read
+  if (nvs.getBytesLength(key) == length)
+  {
+    uint8_t *stored = (uint8_t*)malloc(length);
+    bool same = stored != nullptr && nvs.getBytes(key, stored, length) == length && memcmp(stored, value, length) == 0;
+    free(stored);
+    if (same) return true;
+  }
+  if (nvs.putBytes(key, value, length) != length) return false;
+  countWrite(length);
+  return true;
+}
+
+void DataManager::statsKeys(const char nameSpace[], char entriesKey[], char bytesKey[])
+{
+  // namespace names are at most 14 chars, keys take 15
+  snprintf(entriesKey, 16, "%.14sE", nameSpace);
+  snprintf(bytesKey, 16, "%.14sB", nameSpace);
+}
+
+void DataManager::addWriteStats(const char nameSpace[], uint32_t entries, uint32_t bytes)
+{
+  int i = 0;
+  while (i < numPendingStats && strcmp(pendingStats[i].nameSpace, nameSpace) != 0) i++;
+
+  if (i == numPendingStats)
+  {
+    if (numPendingStats == maxPendingStats)
+    {
+      flushWriteStats();
+      i = 0;
+    }
+    strlcpy(pendingStats[i].nameSpace, nameSpace, sizeof(pendingStats[i].nameSpace));
+    pendingStats[i].stats = {};
+    numPendingStats = i + 1;
+  }
+  pendingStats[i].stats.entries += entries;
+  pendingStats[i].stats.bytes += bytes;
+}
+
+bool DataManager::flushWriteStats()
+{
+  char entriesKey[16], bytesKey[16], ownEntriesKey[16], ownBytesKey[16];
+
+  if (numPendingStats == 0) return true;
+  if (!nvs.begin(masterKeyWriteStats, false))
   {
     return false;
   }
-  for(int i = 0; i<numModules; i++)
+  // the counters are flash writes too, two entries per namespace plus the two own ones
+  uint32_t ownEntries = 2 * numPendingStats + 2;
+  for (int i = 0; i < numPendingStats; i++)
   {
-    nvs.putInt(keys[i].c_str(), sensor[i].id);
+    statsKeys(pendingStats[i].nameSpace, entriesKey, bytesKey);
+    nvs.putUInt(entriesKey, nvs.getUInt(entriesKey, 0) + pendingStats[i].stats.entries);
+    nvs.putUInt(bytesKey, nvs.getUInt(bytesKey, 0) + pendingStats[i].stats.bytes);
   }
+  statsKeys(masterKeyWriteStats, ownEntriesKey, ownBytesKey);
+  nvs.putUInt(ownEntriesKey, nvs.getUInt(ownEntriesKey, 0) + ownEntries);
+  nvs.putUInt(ownBytesKey, nvs.getUInt(ownBytesKey, 0) + ownEntries * nvsEntrySize);
   nvs.end();
 
+  numPendingStats = 0;
   return true;
 }
 
+bool DataManager::loadWriteStats(const char nameSpace[], NvsWriteStats &stats)
+{
+  char entriesKey[16], bytesKey[16];
+
+  statsKeys(nameSpace, entriesKey, bytesKey);
+  stats = {};
+
+  if (nvs.begin(masterKeyWriteStats, true)) // missing until the first flush
+  {
+    stats.entries = nvs.getUInt(entriesKey, 0);
+    stats.bytes = nvs.getUInt(bytesKey, 0);
+    nvs.end();
+  }
+
+  for (int i = 0; i < numPendingStats; i++)
+  {
+    if (strcmp(pendingStats[i].nameSpace, nameSpace) != 0) continue;
+    stats.entries += pendingStats[i].stats.entries;
+    stats.bytes += pendingStats[i].stats.bytes;
+  }
+  return true;
+}
+
+bool DataManager::loadTotalWriteStats(NvsWriteStats &total)
+{
+  const char *nameSpaces[] = {masterkeyHumi, masterkeyTemp, "calibrationMax", "calibrationMin", masterkeyWifi, masterkeyApi, masterkeyLinksApi,
+                              masterKeyWaterFlowSensor, masterKeyIrrigation, masterKeyTempProbes, masterKeyConfig, masterKeyWriteStats};
+  const size_t numNameSpaces = sizeof(nameSpaces) / sizeof(nameSpaces[0]);
+
+  total = {};
+  for (size_t i = 0; i < numNameSpaces; i++)
+  {
+    NvsWriteStats stats;
+    if (!loadWriteStats(nameSpaces[i], stats)) return false;
+    total.entries += stats.entries;
+    total.bytes += stats.bytes;
+  }
+  return true;
+}
+
+//====================================================================
+
+bool DataManager::storageIDsData(char masterKey[], Sensor sensor[])
+{
+  if (!openForWrite(masterKey))
+  {
+    return false;
+  }
+  bool written = true;
+  for(int i = 0; i<numModules; i++)
+  {
+    written &= writeInt(keys[i].c_str(), sensor[i].id);
+  }
+  closeWrite();
+
+  return written;
+}
+
 bool DataManager::storageHumiCalibrationData(Sensor sensor[])
 {
-  if (!nvs.begin("calibrationMax", false)) // false -> write and read
+  bool written = true;
+
+  if (!openForWrite("calibrationMax"))
   {
     return false;
   }
   for(int i = 0; i<numModules; i++)
   {
-    nvs.putInt(keys[i].c_str(), sensor[i].maxValueAdc);
+    written &= writeInt(keys[i].c_str(), sensor[i].maxValueAdc);
   }
-  nvs.end();
+  closeWrite();
 
-  if (!nvs.begin("calibrationMin", false)) // false -> write and read
+  if (!openForWrite("calibrationMin"))
   {
     return false;
   }
   for(int i = 0; i<numModules; i++)
   {
-    nvs.putInt(keys[i].c_str(), sensor[i].minValueAdc);
+    written &= writeInt(keys[i].c_str(), sensor[i].minValueAdc);
   }
-  nvs.end();
+  closeWrite();
 
-  return true;
+  return written;
 }
 
 bool DataManager::storageCredentials(Credentials &credentials, char key[])
 {
-  if (!nvs.begin(key, false)) // false -> write and read
+  if (!openForWrite(key))
   {
     return false;
   }
-  nvs.putString(keyLogin, credentials.login);
-  nvs.putString(keyPassword, credentials.password);
+  bool written = writeString(keyLogin, credentials.login);
+  written &= writeString(keyPassword, credentials.password);
   
-  nvs.end();
+  closeWrite();
 
-  return true;
+  return written;
 }
 
 bool DataManager::storageApiLinks(ApiLinks &apiLinks)
 {
-  if (!nvs.begin(masterkeyLinksApi , false)) // false -> write and read
+  if (!openForWrite(masterkeyLinksApi))
   {
     return false;
   }
 
-  nvs.putString(keylinkToAuthenticate, apiLinks.linkToAuthenticate);
-  nvs.putString(keylinkToSensorsReading, apiLinks.linkToSensorsReading);
-  nvs.putString(keylinkToValveState, apiLinks.linkToValveState);
-  nvs.putString(keylinkToTimeValve, apiLinks.linkToTimeValve);
-  nvs.putString(keylinkToWaterFlow, apiLinks.linkToWaterFlow);
+  bool written = writeString(keylinkToAuthenticate, apiLinks.linkToAuthenticate);
+  written &= writeString(keylinkToSensorsReading, apiLinks.linkToSensorsReading);
+  written &= writeString(keylinkToValveState, apiLinks.linkToValveState);
+  written &= writeString(keylinkToTimeValve, apiLinks.linkToTimeValve);
+  written &= writeString(keylinkToWaterFlow, apiLinks.linkToWaterFlow);
+  written &= writeString(keylinkToMqttBroker, apiLinks.linkToMqttBroker);
+  written &= writeUChar(keySensorsFormat, apiLinks.sensorsFormat);
+  written &= writeUChar(keyWaterFlowFormat, apiLinks.waterFlowFormat);
 
-  nvs.end();
+  closeWrite();
 
-  return true;
+  return written;
 }
 
 bool DataManager::storageWaterFlow(uint64_t &flow)
 {
-  if(!nvs.begin(masterKeyWaterFlowSensor, false)) // false -> write and read
+  if(!openForWrite(masterKeyWaterFlowSensor))
+  {
+    return false;
+  }
+  bool written = writeULong64(keyFlowValue, flow);
+
+  closeWrite();
+  return written;
+}
+
+uint32_t DataManager::flowCheckpointCrc(FlowCheckpoint &checkpoint)
+{
+  return esp_rom_crc32_le(0, (const uint8_t*)&checkpoint, offsetof(FlowCheckpoint, crc));
+}
+
+bool DataManager::storeFlowCheckpoint(FlowCheckpoint &checkpoint)
+{
+  checkpoint.crc = flowCheckpointCrc(checkpoint);
+
+  if(!openForWrite(masterKeyWaterFlowSensor))
   {
     return false;
   }
-  nvs.putULong64(keyFlowValue, flow);
+  // a torn write only loses this slot, the previous sequence is still intact in another key
+  bool written = writeBytes(journalKeys[checkpoint.sequence % flowJournalSlots].c_str(), &checkpoint, sizeof(FlowCheckpoint));
+  closeWrite();
+
+  return written;
+}
 
+bool DataManager::loadFlowCheckpoint(FlowCheckpoint &checkpoint)
+{
+  bool found = false;
+
+  if(!nvs.begin(masterKeyWaterFlowSensor, true))
+  {
+    return false;
+  }
+  for(int i = 0; i<flowJournalSlots; i++)
+  {
+    FlowCheckpoint slot;
+
+    if(nvs.getBytes(journalKeys[i].c_str(), &slot, sizeof(FlowCheckpoint)) != sizeof(FlowCheckpoint)) continue;
+    if(slot.crc != flowCheckpointCrc(slot)) continue;
+
+    if(!found || (int32_t)(slot.sequence - checkpoint.sequence) > 0) // wrap-safe
+    {
+      checkpoint = slot;
+      found = true;
+    }
+  }
   nvs.end();
-  return true;
+
+  return found;
+}
+
+bool DataManager::isValidSchedule(TimeIrrigation &timeIrrigation)
+{
+  struct tm &start = timeIrrigation.initialTime;
+  struct tm &end = timeIrrigation.finalTime;
+
+  if (start.tm_hour < 0 || start.tm_hour > 23 || start.tm_min < 0 || start.tm_min > 59) return false;
+  if (end.tm_hour == 24) return end.tm_min == 0;
+  return end.tm_hour >= 0 && end.tm_hour <= 23 && end.tm_min >= 0 && end.tm_min <= 59;
+}
+
+uint32_t DataManager::packSchedule(TimeIrrigation &timeIrrigation)
+{
+  if (!isValidSchedule(timeIrrigation)) return scheduleLayoutBit; // masking would turn 09:99 into 09:35
+
+  // layout bit | enabled 29 | weekDays 28..22 | initial hh 21..17, mm 16..11 | final hh 10..6, mm 5..0
+  return scheduleLayoutBit | ((uint32_t)timeIrrigation.enabled << 29) | ((uint32_t)(timeIrrigation.weekDays & allWeekDays) << 22) |
+         ((uint32_t)(timeIrrigation.initialTime.tm_hour & 0x1F) << 17) | ((uint32_t)(timeIrrigation.initialTime.tm_min & 0x3F) << 11) |
+         ((uint32_t)(timeIrrigation.finalTime.tm_hour & 0x1F) << 6) | (uint32_t)(timeIrrigation.finalTime.tm_min & 0x3F);
+}
+
+void DataManager::unpackSchedule(uint32_t packed, TimeIrrigation &timeIrrigation)
+{
+  if(!(packed & scheduleLayoutBit)) // hh/mm/hh/mm bytes, 00:00-00:00 was the empty slot
+  {
+    timeIrrigation.initialTime.tm_hour = (packed >> 24) & 0xFF;
+    timeIrrigation.initialTime.tm_min = (packed >> 16) & 0xFF;
+    timeIrrigation.finalTime.tm_hour = (packed >> 8) & 0xFF;
+    timeIrrigation.finalTime.tm_min = packed & 0xFF;
+    timeIrrigation.enabled = packed != 0;
+    timeIrrigation.weekDays = allWeekDays;
+  }
+  else
+  {
+    timeIrrigation.enabled = (packed >> 29) & 0x01;
+    timeIrrigation.weekDays = (packed >> 22) & allWeekDays;
+    timeIrrigation.initialTime.tm_hour = (packed >> 17) & 0x1F;
+    timeIrrigation.initialTime.tm_min = (packed >> 11) & 0x3F;
+    timeIrrigation.finalTime.tm_hour = (packed >> 6) & 0x1F;
+    timeIrrigation.finalTime.tm_min = packed & 0x3F;
+  }
+  if (!isValidSchedule(timeIrrigation)) timeIrrigation.enabled = false; // the fields hold up to 31:63
 }
 
 bool DataManager::storageIrrigationSchedules(TimeIrrigation timeIrrigation[])
 {
-  if (!nvs.begin(masterKeyIrrigation, false)) // false -> writing and read
+  if (!openForWrite(masterKeyIrrigation))
   {
     return false;
   }
+  bool written = true;
   for(int i = 0; i<maxIrrigationSlots; i++)
   {
-    char buffer[12];
-    sprintf(buffer, "%02d:%02d;%02d:%02d",timeIrrigation[i].initialTime.tm_hour, timeIrrigation[i].initialTime.tm_min, timeIrrigation[i].finalTime.tm_hour, timeIrrigation[i].finalTime.tm_min);
-    nvs.putString(keys[i].c_str(), buffer);
+    // one uint32 entry per slot, only slots that changed hit the flash
+    written &= writeUInt(scheduleKeys[i].c_str(), packSchedule(timeIrrigation[i]));
+    if (nvs.isKey(keys[i].c_str()) && nvs.remove(keys[i].c_str())) countWrite(0); // legacy "hh:mm;hh:mm" string
+  }
+  closeWrite();
+  return written;
+}
+
+bool DataManager::storageTempProbes(TempProbeTable &table)
+{
+  if (!openForWrite(masterKeyTempProbes))
+  {
+    return false;
+  }
+  bool written = writeBytes(keyProbeTable, &table, sizeof(TempProbeTable));
+  closeWrite();
+
+  return written;
+}
+
+uint32_t DataManager::configCrc(ConfigRecord &config)
+{
+  const size_t headerSize = offsetof(ConfigRecord, humiId);
+  return esp_rom_crc32_le(0, (const uint8_t*)&config + headerSize, sizeof(ConfigRecord) - headerSize);
+}
+
+bool DataManager::loadConfigRecord()
+{
+  if (!nvs.begin(masterKeyConfig, true))
+  {
+    return false;
+  }
+  size_t length = nvs.getBytes(keyConfigRecord, &record, sizeof(ConfigRecord));
+  nvs.end();
+
+  if (length != sizeof(ConfigRecord) || record.size != sizeof(ConfigRecord) || record.version != configVersion) // missing or older layout
+  {
+    return false;
+  }
+  return record.crc == configCrc(record);
+}
+
+bool DataManager::storeConfigRecord()
+{
+  record.version = configVersion;
+  record.size = sizeof(ConfigRecord);
+  record.crc = configCrc(record);
+
+  if (!openForWrite(masterKeyConfig))
+  {
+    return false;
+  }
+  bool written = writeBytes(keyConfigRecord, &record, sizeof(ConfigRecord));
+  closeWrite();
+
+  return written;
+}
+
+bool DataManager::mirrorConfigRecord()
+{
+  if (storeConfigRecord()) return true;
+  dropConfigRecord(); // the old blob still has a valid crc, boot would load it over the newer keys
+  return false;
+}
+
+void DataManager::dropConfigRecord()
+{
+  if (!nvs.begin(masterKeyConfig, false))
+  {
+    return;
   }
+  nvs.remove(keyConfigRecord);
   nvs.end();
+}
+
+bool DataManager::packString(char field[], size_t fieldSize, const String &value)
+{
+  if (value.length() >= fieldSize)
+  {
+    return false;
+  }
+  memset(field, 0, fieldSize); // padding is part of the crc
+  memcpy(field, value.c_str(), value.length());
   return true;
 }
 
+bool DataManager::packCredentials(char login[], size_t loginSize, char password[], size_t passwordSize, Credentials &credentials)
+{
+  return packString(login, loginSize, credentials.login) && packString(password, passwordSize, credentials.password);
+}
+
+bool DataManager::packApiLinks(ConfigRecord &config, ApiLinks &apiLinks)
+{
+  config.sensorsFormat = apiLinks.sensorsFormat;
+  config.waterFlowFormat = apiLinks.waterFlowFormat;
+
+  return packString(config.linkToAuthenticate, sizeof(config.linkToAuthenticate), apiLinks.linkToAuthenticate) &&
+         packString(config.linkToSensorsReading, sizeof(config.linkToSensorsReading), apiLinks.linkToSensorsReading) &&
+         packString(config.linkToValveState, sizeof(config.linkToValveState), apiLinks.linkToValveState) &&
+         packString(config.linkToTimeValve, sizeof(config.linkToTimeValve), apiLinks.linkToTimeValve) &&
+         packString(config.linkToWaterFlow, sizeof(config.linkToWaterFlow), apiLinks.linkToWaterFlow) &&
+         packString(config.linkToMqttBroker, sizeof(config.linkToMqttBroker), apiLinks.linkToMqttBroker);
+}
+
+void DataManager::packSchedules(ConfigRecord &config, TimeIrrigation timeIrrigation[])
+{
+  for(int i = 0; i<maxIrrigationSlots; i++)
+  {
+    config.schedules[i] = packSchedule(timeIrrigation[i]);
+  }
+}
+
+void DataManager::unpackConfig(ConfigRecord &config, Sensor sensorH[], Sensor sensorT[], Credentials &wifi, Credentials &api, ApiLinks &apiLinks, TimeIrrigation timeIrrigation[])
+{
+  for(int i = 0; i<numModules; i++)
+  {
+    sensorH[i].id = config.humiId[i];
+    sensorT[i].id = config.tempId[i];
+    sensorH[i].maxValueAdc = config.humiMaxAdc[i];
+    sensorH[i].minValueAdc = config.humiMinAdc[i];
+  }
+
+  wifi.login = config.wifiLogin;
+  wifi.password = config.wifiPassword;
+  api.login = config.apiLogin;
+  api.password = config.apiPassword;
+
+  apiLinks.linkToAuthenticate = config.linkToAuthenticate;
+  apiLinks.linkToSensorsReading = config.linkToSensorsReading;
+  apiLinks.linkToValveState = config.linkToValveState;
+  apiLinks.linkToTimeValve = config.linkToTimeValve;
+  apiLinks.linkToWaterFlow = config.linkToWaterFlow;
+  apiLinks.linkToMqttBroker = config.linkToMqttBroker;
+  apiLinks.sensorsFormat = (PayloadFormat)config.sensorsFormat;
+  apiLinks.waterFlowFormat = (PayloadFormat)config.waterFlowFormat;
+
+  for(int i = 0; i<maxIrrigationSlots; i++)
+  {
+    unpackSchedule(config.schedules[i], timeIrrigation[i]);
+  }
+}
+
+bool DataManager::migrateConfig(Sensor sensorH[], Sensor sensorT[], Credentials &wifi, Credentials &api, ApiLinks &apiLinks, TimeIrrigation timeIrrigation[])
+{
+  memset(&record, 0, sizeof(ConfigRecord));
+
+  for(int i = 0; i<numModules; i++)
+  {
+    record.humiId[i] = sensorH[i].id;
+    record.tempId[i] = sensorT[i].id;
+    record.humiMaxAdc[i] = sensorH[i].maxValueAdc;
+    record.humiMinAdc[i] = sensorH[i].minValueAdc;
+  }
+  packSchedules(record, timeIrrigation);
+
+  if (!packCredentials(record.wifiLogin, sizeof(record.wifiLogin), record.wifiPassword, sizeof(record.wifiPassword), wifi) ||
+      !packCredentials(record.apiLogin, sizeof(record.apiLogin), record.apiPassword, sizeof(record.apiPassword), api) ||
+      !packApiLinks(record, apiLinks))
+  {
+    return false; // oversized value, boots keep reading the namespaces
+  }
+  return storeConfigRecord();
+}
+
 //====================================================================
 
 bool DataManager::loadIDsData(char masterKey[], Sensor sensor[])
@@ -174,6 +599,9 @@ bool DataManager::loadApiLinks(ApiLinks &apiLinks)
   apiLinks.linkToValveState = nvs.getString(keylinkToValveState, "");
   apiLinks.linkToTimeValve = nvs.getString(keylinkToTimeValve, "");
   apiLinks.linkToWaterFlow = nvs.getString(keylinkToWaterFlow, "");
+  apiLinks.linkToMqttBroker = nvs.getString(keylinkToMqttBroker, "");
+  apiLinks.sensorsFormat = (PayloadFormat)nvs.getUChar(keySensorsFormat, PAYLOAD_JSON);
+  apiLinks.waterFlowFormat = (PayloadFormat)nvs.getUChar(keyWaterFlowFormat, PAYLOAD_JSON);
 
   nvs.end();
 
@@ -202,11 +630,20 @@ bool DataManager::loadIrrigationSchedules(TimeIrrigation timeIrrigation[])
   }
   for(int i = 0; i<maxIrrigationSlots; i++)
   {
-    String scheduleString = nvs.getString(keys[i].c_str(), "");
+    if (nvs.isKey(scheduleKeys[i].c_str()))
+    {
+      unpackSchedule(nvs.getUInt(scheduleKeys[i].c_str(), 0), timeIrrigation[i]);
+      continue;
+    }
+
+    String scheduleString = nvs.getString(keys[i].c_str(), ""); // written before the typed entries
     
     if (scheduleString.length()> 0)
     {
       sscanf(scheduleString.c_str(),  "%02d:%02d;%02d:%02d", &timeIrrigation[i].initialTime.tm_hour, &timeIrrigation[i].initialTime.tm_min, &timeIrrigation[i].finalTime.tm_hour, &timeIrrigation[i].finalTime.tm_min);
+      timeIrrigation[i].enabled = !(timeIrrigation[i].initialTime.tm_hour == 0 && timeIrrigation[i].initialTime.tm_min == 0 &&
+                                    timeIrrigation[i].finalTime.tm_hour == 0 && timeIrrigation[i].finalTime.tm_min == 0);
+      timeIrrigation[i].weekDays = allWeekDays;
     }
   }
   nvs.end();
@@ -214,6 +651,23 @@ bool DataManager::loadIrrigationSchedules(TimeIrrigation timeIrrigation[])
   return true;
 }
 
+bool DataManager::loadTempProbes(TempProbeTable &table)
+{
+  if (!nvs.begin(masterKeyTempProbes, true)) 
+  {
+    return false;
+  }
+  if (nvs.getBytesLength(keyProbeTable) != sizeof(TempProbeTable)) // missing or older layout
+  {
+    nvs.end();
+    return false;
+  }
+  nvs.getBytes(keyProbeTable, &table, sizeof(TempProbeTable));
+  nvs.end();
+
+  return true;
+}
+
 bool DataManager::loadTempIDs(Sensor sensorT[]) {
   return loadIDsData(masterkeyTemp, sensorT);
 }
@@ -242,6 +696,11 @@ bool DataManager::loadIrrigationSchedulesData(TimeIrrigation timeIrrigation[])
   return loadIrrigationSchedules(timeIrrigation);
 }
 
+bool DataManager::loadTempProbesData(TempProbeTable &table)
+{
+  return loadTempProbes(table);
+}
+
 bool DataManager::areSchedulesEqual(TimeIrrigation savedSchedules[], TimeIrrigation apiSchedules[])
 {
   for (int i = 0; i < maxIrrigationSlots; i++) 
@@ -263,6 +722,10 @@ bool DataManager::areSchedulesEqual(TimeIrrigation savedSchedules[], TimeIrrigat
     {
       return false;
     }
+    if (savedSchedules[i].enabled != apiSchedules[i].enabled || savedSchedules[i].weekDays != apiSchedules[i].weekDays)
+    {
+      return false;
+    }
   }
   return true; 
 }
@@ -270,7 +733,13 @@ bool DataManager::areSchedulesEqual(TimeIrrigation savedSchedules[], TimeIrrigat
 
 bool DataManager::loadAllData(Sensor sensorH[], Sensor sensorT[], Credentials &wifi, Credentials &api, ApiLinks &apiLinks, TimeIrrigation timeIrrigation[]) 
 {
-  bool nvsOK = true;
+  if (loadConfigRecord())
+  {
+    unpackConfig(record, sensorH, sensorT, wifi, api, apiLinks, timeIrrigation);
+    return true;
+  }
+
+  bool nvsOK = true; // no blob or a bad crc, per-namespace keys
 
   if (!loadTempIDs(sensorT))
   {
@@ -307,48 +776,132 @@ bool DataManager::loadAllData(Sensor sensorH[], Sensor sensorT[], Credentials &w
     nvsOK = false;
   }
 
+  if(nvsOK) migrateConfig(sensorH, sensorT, wifi, api, apiLinks, timeIrrigation); // first boot with the blob
+
   return nvsOK;  // Retorna true se todas as operações foram bem-sucedidas, false se alguma falhar
 }
 
+// stores write the namespace keys first, then mirror the change into the blob when one exists
+// a failed key or blob write drops the blob, otherwise boot would load its stale copy over the keys
+
 bool DataManager::storeTempIDs(Sensor sensorT[]) {
-  return storageIDsData(masterkeyTemp, sensorT);
+  if (!storageIDsData(masterkeyTemp, sensorT))
+  {
+    dropConfigRecord();
+    return false;
+  }
+  if (loadConfigRecord())
+  {
+    for(int i = 0; i<numModules; i++) record.tempId[i] = sensorT[i].id;
+    mirrorConfigRecord();
+  }
+  return true;
 }
 bool DataManager::storeHumiIDs(Sensor sensorH[]) {
-  return storageIDsData(masterkeyHumi, sensorH);
+  if (!storageIDsData(masterkeyHumi, sensorH))
+  {
+    dropConfigRecord();
+    return false;
+  }
+  if (loadConfigRecord())
+  {
+    for(int i = 0; i<numModules; i++) record.humiId[i] = sensorH[i].id;
+    mirrorConfigRecord();
+  }
+  return true;
 }
 
 bool DataManager::storeHumiCalibration(Sensor sensorH[]) {
-  return storageHumiCalibrationData(sensorH);
+  if (!storageHumiCalibrationData(sensorH))
+  {
+    dropConfigRecord();
+    return false;
+  }
+  if (loadConfigRecord())
+  {
+    for(int i = 0; i<numModules; i++)
+    {
+      record.humiMaxAdc[i] = sensorH[i].maxValueAdc;
+      record.humiMinAdc[i] = sensorH[i].minValueAdc;
+    }
+    mirrorConfigRecord();
+  }
+  return true;
 }
 
 bool DataManager::storeWiFiCredentials(Credentials &wifi) {
-  return storageCredentials(wifi, masterkeyWifi);
+  if (!storageCredentials(wifi, masterkeyWifi))
+  {
+    dropConfigRecord();
+    return false;
+  }
+  if (loadConfigRecord())
+  {
+    if (packCredentials(record.wifiLogin, sizeof(record.wifiLogin), record.wifiPassword, sizeof(record.wifiPassword), wifi)) mirrorConfigRecord();
+    else dropConfigRecord();
+  }
+  return true;
 }
 
 bool DataManager::storeApiCredentials(Credentials &api) {
-  return storageCredentials(api, masterkeyApi);
+  if (!storageCredentials(api, masterkeyApi))
+  {
+    dropConfigRecord();
+    return false;
+  }
+  if (loadConfigRecord())
+  {
+    if (packCredentials(record.apiLogin, sizeof(record.apiLogin), record.apiPassword, sizeof(record.apiPassword), api)) mirrorConfigRecord();
+    else dropConfigRecord();
+  }
+  return true;
 }
 
 bool DataManager::storeApiLinkData(ApiLinks &apiLinks) {
-  return storageApiLinks(apiLinks);
+  if (!storageApiLinks(apiLinks))
+  {
+    dropConfigRecord();
+    return false;
+  }
+  if (loadConfigRecord())
+  {
+    if (packApiLinks(record, apiLinks)) mirrorConfigRecord();
+    else dropConfigRecord();
+  }
+  return true;
 }
 
 bool DataManager::storeWaterFlowData(uint64_t &flow) {
   return storageWaterFlow(flow);
 }
 
+bool DataManager::storeTempProbesData(TempProbeTable &table) {
+  return storageTempProbes(table);
+}
+
 bool DataManager::compareAndStoreIrrigationSchedulesData(TimeIrrigation savedSchedules[], TimeIrrigation apiSchedules[])
 {
+  for(int i = 0; i<maxIrrigationSlots; i++)
+  {
+    unpackSchedule(packSchedule(apiSchedules[i]), apiSchedules[i]); // as a reboot would load it, an invalid slot compares equal to its stored copy
+  }
   if(!areSchedulesEqual(savedSchedules, apiSchedules))
   {
-    if(storageIrrigationSchedules(apiSchedules))
+    if(!storageIrrigationSchedules(apiSchedules))
+    {
+      dropConfigRecord();
+      return false;
+    }
+    if (loadConfigRecord())
+    {
+      packSchedules(record, apiSchedules);
+      mirrorConfigRecord();
+    }
+    for(int i = 0; i<maxIrrigationSlots; i++)
     {
-      for(int i = 0; i<maxIrrigationSlots; i++)
-      {
-        savedSchedules[i] = apiSchedules[i];
-      }
-      return true;
+      savedSchedules[i] = apiSchedules[i];
     }
+    return true;
   }
   return false;
 }
@@ -4,6 +4,7 @@
 #include <Preferences.h>
 #include <nvs_flash.h>
 #include "esp_system.h"
+#include "esp_rom_crc.h"
 #include <Arduino.h>
 
 #include "serial_io_manager.hpp"
@@ -12,6 +13,56 @@
 extern const int numModules;
 extern const int maxIrrigationSlots;
 
+const int maxConfigModules = 10; // same limit as the k1..k10 keys
+const int maxConfigSlots = 10;
+
+// every boot setting in one nvs blob, the per-namespace keys stay as the fallback copy
+typedef struct
+{
+  uint16_t version;
+  uint16_t size;   // sizeof(ConfigRecord) when written
+  uint32_t crc;    // of everything after this field
+  int32_t humiId[maxConfigModules];
+  int32_t tempId[maxConfigModules];
+  int32_t humiMaxAdc[maxConfigModules];
+  int32_t humiMinAdc[maxConfigModules];
+  char wifiLogin[33];
+  char wifiPassword[65];
+  char apiLogin[64];
+  char apiPassword[64];
+  char linkToAuthenticate[128];
+  char linkToSensorsReading[128];
+  char linkToValveState[128];
+  char linkToTimeValve[128];
+  char linkToWaterFlow[128];
+  char linkToMqttBroker[128];
+  uint8_t sensorsFormat;
+  uint8_t waterFlowFormat;
+  uint32_t schedules[maxConfigSlots]; // packSchedule layout
+}ConfigRecord;
+
+// water totalizer checkpoint, written round-robin over flowJournalSlots keys
+typedef struct
+{
+  uint64_t totalPulses;      // cumulative since the first boot
+  uint64_t eventStartPulses; // totalPulses when the last event volume was reported
+  uint32_t sequence;         // newest valid slot wins
+  uint32_t crc;              // of everything before this field
+}FlowCheckpoint;
+
+typedef struct
+{
+  uint32_t entries; // 32-byte nvs entries written
+  uint32_t bytes;
+}NvsWriteStats;
+
+// counters not yet added to the "nvsStats" namespace
+typedef struct
+{
+  char nameSpace[16];
+  NvsWriteStats stats;
+}PendingWriteStats;
+
 class DataManager
 {
   private:
@@ -22,6 +73,9 @@ class DataManager
     char masterkeyLinksApi[9] = "apiLinks";
     char masterKeyWaterFlowSensor[11] = "flowSensor";
     char masterKeyIrrigation[15] = "timeIrrigation";
+    char masterKeyTempProbes[11] = "tempProbes";
+    char masterKeyConfig[7] = "config";
+    char masterKeyWriteStats[9] = "nvsStats";
     char keyLogin[6] = "login";
     char keyPassword[9] = "password";
     
@@ -30,10 +84,46 @@ class DataManager
     char keylinkToValveState[6] = "valve";
     char keylinkToWaterFlow[10] = "waterFlow";
     char keylinkToTimeValve[10] = "timeValve";
+    char keylinkToMqttBroker[11] = "mqttBroker";
+    char keySensorsFormat[13] = "sensorFormat";
+    char keyWaterFlowFormat[11] = "flowFormat";
     char keyFlowValue[10] = "FlowValue";
+    char keyProbeTable[6] = "table";
+    char keyConfigRecord[7] = "record";
     String keys[10] = {"k1", "k2", "k3", "k4", "k5", "k6", "k7","k8","k9","k10"}; //for data arrays,  max = 10;
+    String journalKeys[4] = {"j0", "j1", "j2", "j3"};
+    String scheduleKeys[10] = {"s1", "s2", "s3", "s4", "s5", "s6", "s7","s8","s9","s10"}; // packed uint32 per slot, replaces the kN strings
+
+    static const uint16_t configVersion = 2; // 2 -> packed schedules with enabled/weekDays
+    static const uint32_t scheduleLayoutBit = 0x80000000; // packed entries from before it hold hh/mm/hh/mm bytes
+    static const uint32_t nvsEntrySize = 32;
+    static const int flowJournalSlots = 4; // spreads the checkpoint writes over four keys
+    static const int maxPendingStats = 12; // one per namespace DataManager writes
 
     Preferences nvs;
+    ConfigRecord record; // 1.2 KB, kept off the setup stack
+
+    char openNamespace[16] = {};
+    uint32_t sessionEntries = 0; // written since openForWrite
+    uint32_t sessionBytes = 0;
+    PendingWriteStats pendingStats[maxPendingStats] = {};
+    int numPendingStats = 0;
+
+    // write layer: compare with the stored value, commit only what changed, count the flash it costs
+    bool openForWrite(const char nameSpace[]);
+    void closeWrite(); // adds the session to the pending counters
+    void countWrite(size_t dataLength); // 0 -> fixed-size entry
+    bool writeInt(const char key[], int32_t value);
+    bool writeUInt(const char key[], uint32_t value);
+    bool writeUChar(const char key[], uint8_t value);
+    bool writeULong64(const char key[], uint64_t value);
+    bool writeString(const char key[], const String &value);
+    bool writeBytes(const char key[], const void *value, size_t length);
+    void statsKeys(const char nameSpace[], char entriesKey[], char bytesKey[]);
+    void addWriteStats(const char nameSpace[], uint32_t entries, uint32_t bytes); // ram only, flushWriteStats commits
+    bool isValidSchedule(TimeIrrigation &timeIrrigation); // hh 0-23, final 24:00 allowed, mm 0-59
+    uint32_t packSchedule(TimeIrrigation &timeIrrigation); // invalid slots pack as empty
+    void unpackSchedule(uint32_t packed, TimeIrrigation &timeIrrigation); // out-of-range fields -> disabled
   
     bool storageIDsData(char masterKey[], Sensor sensor[]);
     bool storageHumiCalibrationData(Sensor sensor[]);
@@ -41,6 +131,7 @@ class DataManager
     bool storageWaterFlow(uint64_t &flow);
     bool storageApiLinks(ApiLinks &apiLinks);
     bool storageIrrigationSchedules(TimeIrrigation timeIrrigation[]);
+    bool storageTempProbes(TempProbeTable &table);
 
     bool loadIDsData(char masterKey[], Sensor sensor[]);
     bool loadHumiCalibrationData(Sensor sensor[]);
@@ -48,7 +139,21 @@ class DataManager
     bool loadWaterFlow(uint64_t &flow); //consultar pessoal do front;
     bool loadApiLinks(ApiLinks &apiLinks);
     bool loadIrrigationSchedules(TimeIrrigation timeIrrigation[]);
+    bool loadTempProbes(TempProbeTable &table);
     bool areSchedulesEqual(TimeIrrigation savedSchedules[], TimeIrrigation apiSchedules[]);
+
+    uint32_t flowCheckpointCrc(FlowCheckpoint &checkpoint);
+    uint32_t configCrc(ConfigRecord &config);
+    bool loadConfigRecord();  // single read + crc into record
+    bool storeConfigRecord(); // crc and write record
+    bool mirrorConfigRecord(); // store, drop the blob when the write fails
+    void dropConfigRecord();  // blob can no longer mirror the keys, next boot migrates again
+    bool packString(char field[], size_t fieldSize, const String &value); // false when it does not fit
+    bool packCredentials(char login[], size_t loginSize, char password[], size_t passwordSize, Credentials &credentials);
+    bool packApiLinks(ConfigRecord &config, ApiLinks &apiLinks);
+    void packSchedules(ConfigRecord &config, TimeIrrigation timeIrrigation[]);
+    void unpackConfig(ConfigRecord &config, Sensor sensorH[], Sensor sensorT[], Credentials &wifi, Credentials &api, ApiLinks &apiLinks, TimeIrrigation timeIrrigation[]);
+    bool migrateConfig(Sensor sensorH[], Sensor sensorT[], Credentials &wifi, Credentials &api, ApiLinks &apiLinks, TimeIrrigation timeIrrigation[]);
   public:
     bool loadTempIDs(Sensor sensorT[]);
     bool loadHumiIDs(Sensor sensorH[]);
@@ -57,6 +162,7 @@ class DataManager
     bool loadApiCredentials(Credentials &api);
     bool loadApiLinkData(ApiLinks &apiLinks);
     bool loadIrrigationSchedulesData(TimeIrrigation timeIrrigation[]);
+    bool loadTempProbesData(TempProbeTable &table);
 
     bool loadAllData(Sensor sensorH[], Sensor sensorT[], Credentials &wifi, Credentials &api, ApiLinks &apiLinks, TimeIrrigation timeIrrigation[]);
 
@@ -67,8 +173,15 @@ class DataManager
     bool storeApiCredentials(Credentials &api);
     bool storeApiLinkData(ApiLinks &apiLinks);
     bool storeWaterFlowData(uint64_t &flow);
+    bool storeTempProbesData(TempProbeTable &table);
+    bool storeFlowCheckpoint(FlowCheckpoint &checkpoint); // slot from the sequence, fills the crc
+    bool loadFlowCheckpoint(FlowCheckpoint &checkpoint);  // false when no slot holds a valid checkpoint
     bool compareAndStoreIrrigationSchedulesData(TimeIrrigation savedSchedules[], TimeIrrigation apiSchedules[]);
 
+    bool loadWriteStats(const char nameSpace[], NvsWriteStats &stats); // flash + pending
+    bool loadTotalWriteStats(NvsWriteStats &total); // every namespace written by DataManager
+    bool flushWriteStats(); // pending counters -> nvs, a reset loses at most what was not flushed
+
     void clearSchedulesArray(TimeIrrigation timeIrrigation[]);
     void clearNvs();
 };
@@ -18,6 +18,35 @@ typedef struct
   int minValueAdc; // use in analog sensors
 }Sensor;
 
+typedef enum
+{
+  UPLOAD_SNAPSHOT = 0, // last filtered value of each sensor
+  UPLOAD_AGGREGATE     // count/min/max/mean/stddev since the last upload
+}SensorUploadMode;
+
+typedef enum
+{
+  RADIO_ALWAYS_ON = 0, // associated, core default power save
+  RADIO_MODEM_SLEEP,   // associated, radio wakes only for the dtim listen interval
+  RADIO_DUTY_CYCLED    // radio off between wake windows
+}RadioPowerMode;
+
+typedef enum
+{
+  ENDPOINT_AUTHENTICATE = 0,
+  ENDPOINT_SENSORS_READING,
+  ENDPOINT_VALVE_STATE,
+  ENDPOINT_TIME_VALVE,
+  ENDPOINT_WATER_FLOW,
+  ENDPOINT_COUNT
+}ApiEndpoint;
+
+typedef enum
+{
+  PAYLOAD_JSON = 0,
+  PAYLOAD_CBOR     // integer keys, float32 values, json fallback on 415
+}PayloadFormat;
+
 typedef struct 
 { 
   String linkToAuthenticate;
@@ -25,13 +54,28 @@ typedef struct
   String linkToValveState;
   String linkToTimeValve;
   String linkToWaterFlow;
+  String linkToMqttBroker; // mqtt://host:1883, empty -> http polling only
+  PayloadFormat sensorsFormat;
+  PayloadFormat waterFlowFormat;
 }ApiLinks;
 
+const int maxTempProbes = 40; // all OneWire buses
+
+typedef struct
+{
+  uint8_t numProbes;
+  uint8_t bus[maxTempProbes];
+  uint8_t address[maxTempProbes][8];
+}TempProbeTable;
+
+const uint8_t allWeekDays = 0x7F; // bit n -> tm_wday n, sunday = 0
+
 typedef struct 
 {
   struct tm initialTime;
   struct tm finalTime;
-
+  bool enabled;     // slot holds a schedule, 00:00 starts included; equal times stay empty
+  uint8_t weekDays; // allWeekDays when the api sends no restriction
 }TimeIrrigation;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,39 @@
+#include "deadband_filter.hpp"
+
+void DeadbandFilter::configure(float absolute, float relative, uint32_t maxSilenceInterval)
+{
+  absoluteThreshold = absolute;
+  relativeThreshold = relative;
+  maxSilence = maxSilenceInterval;
+}
+
+bool DeadbandFilter::shouldSend(float value, uint32_t now)
+{
+  if(!hasSent || now - lastSentAt >= maxSilence) return true;
+
+  float delta = fabs(value - lastSentValue);
+  
+  if(delta >= absoluteThreshold) return true;
+  if(relativeThreshold > 0 && delta > 0 && delta >= relativeThreshold * fabs(lastSentValue)) return true;
+
+  suppressedReadings++;
+  return false;
+}
+
+void DeadbandFilter::markSent(float value, uint32_t now)
+{
+  hasSent = true;
+  lastSentValue = value;
+  lastSentAt = now;
+  sentReadings++;
+}
+
+uint32_t DeadbandFilter::getSentCount()
+{
+  return sentReadings;
+}
+
+uint32_t DeadbandFilter::getSuppressedCount()
+{
+  return suppressedReadings;
+}
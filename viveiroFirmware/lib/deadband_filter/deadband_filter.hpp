@@ -0,0 +1,29 @@
+#ifndef _DEADBAND_FILTER_HPP_
+#define _DEADBAND_FILTER_HPP_
+
+#include <Arduino.h>
+
+// report-by-exception decision for one sensor channel
+class DeadbandFilter
+{
+  private:
+    float absoluteThreshold = 0;
+    float relativeThreshold = 0; // fraction of the last sent value
+    uint32_t maxSilence = 0;     // ms, heartbeat
+
+    bool hasSent = false;
+    float lastSentValue = 0;
+    uint32_t lastSentAt = 0;
+
+    uint32_t sentReadings = 0;
+    uint32_t suppressedReadings = 0;
+  public:
+    void configure(float absolute, float relative, uint32_t maxSilenceInterval);
+    bool shouldSend(float value, uint32_t now); // counts a suppressed reading when false
+    void markSent(float value, uint32_t now);
+
+    uint32_t getSentCount();
+    uint32_t getSuppressedCount();
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "flow_analytics.hpp"
+
+void FlowAnalytics::begin(int pulsesPerLiterSensor)
+{
+  pulsesPerLiter = pulsesPerLiterSensor;
+  valveChangedAt = millis();
+}
+
+const FlowSample& FlowAnalytics::sampleAt(int age)
+{
+  return samples[(head - 1 - age + bufferSize) % bufferSize];
+}
+
+uint64_t FlowAnalytics::pulsesInWindow(uint32_t window, uint32_t &elapsed)
+{
+  elapsed = 0;
+  if(numSamples < 2) return 0;
+
+  const FlowSample &newest = sampleAt(0);
+  int age = 1;
+
+  while(age < numSamples - 1 && newest.timestamp - sampleAt(age).timestamp < window)
+  {
+    age++;
+  }
+  elapsed = newest.timestamp - sampleAt(age).timestamp;
+
+  return newest.pulses - sampleAt(age).pulses;
+}
+
+void FlowAnalytics::addSample(uint64_t totalPulses, uint32_t timestamp)
+{
+  taskENTER_CRITICAL(&mux);
+  samples[head] = {timestamp, totalPulses};
+  head = (head + 1) % bufferSize;
+  if(numSamples < bufferSize) numSamples++;
+
+  uint32_t elapsed;
+  uint64_t pulses = pulsesInWindow(rateWindow, elapsed);
+
+  if(elapsed > 0)
+  {
+    float rate = (static_cast<float>(pulses) / pulsesPerLiter) * 60000.0f / elapsed;
+    smoothedRate += rateSmoothing * (rate - smoothedRate);
+  }
+  checkEvents(timestamp);
+  taskEXIT_CRITICAL(&mux);
+}
+
+void FlowAnalytics::checkEvents(uint32_t timestamp)
+{
+  uint32_t elapsed;
+  uint32_t sinceValveChange = timestamp - valveChangedAt;
+
+  if(!valveOpen)
+  {
+    uint64_t pulses = pulsesInWindow(leakWindow, elapsed);
+
+    if(sinceValveChange >= leakSettleTime && elapsed >= leakWindow && pulses >= minLeakPulses)
+    {
+      if(!leakReported) pendingEvent.store(FLOW_EVENT_LEAK);
+      leakReported = true;
+    }
+    else if(pulses == 0)
+    {
+      leakReported = false;
+    }
+  }
+  else
+  {
+    uint64_t pulses = pulsesInWindow(noFlowWindow, elapsed);
+
+    if(sinceValveChange >= noFlowGraceTime && elapsed >= noFlowWindow && pulses == 0)
+    {
+      if(!noFlowReported) pendingEvent.store(FLOW_EVENT_NO_FLOW);
+      noFlowReported = true;
+    }
+    else if(pulses > 0)
+    {
+      noFlowReported = false;
+    }
+  }
+}
+
+void FlowAnalytics::setValveState(bool open)
+{
+  taskENTER_CRITICAL(&mux);
+  if(open != valveOpen)
+  {
+    valveOpen = open;
+    valveChangedAt = millis();
+    leakReported = false;
+    noFlowReported = false;
+  }
+  taskEXIT_CRITICAL(&mux);
+}
+
+float FlowAnalytics::getFlowRate()
+{
+  float rate;
+
+  taskENTER_CRITICAL(&mux);
+  rate = smoothedRate;
+  taskEXIT_CRITICAL(&mux);
+
+  return rate;
+}
+
+FlowEvent FlowAnalytics::takeEvent()
+{
+  return static_cast<FlowEvent>(pendingEvent.exchange(FLOW_EVENT_NONE));
+}
@@ -0,0 +1,60 @@
+#ifndef _FLOW_ANALYTICS_HPP_
+#define _FLOW_ANALYTICS_HPP_
+
+#include <Arduino.h>
+#include <atomic>
+
+typedef enum
+{
+  FLOW_EVENT_NONE = 0,
+  FLOW_EVENT_LEAK,     // flow while the valve is off
+  FLOW_EVENT_NO_FLOW   // valve on without flow (stuck valve, empty line)
+}FlowEvent;
+
+typedef struct
+{
+  uint32_t timestamp; // ms
+  uint64_t pulses;
+}FlowSample;
+
+class FlowAnalytics
+{
+  private:
+    static const int bufferSize = 64; // >= longest window / tick
+
+    FlowSample samples[bufferSize] = {};
+    int head = 0;
+    int numSamples = 0;
+
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+    int pulsesPerLiter = 450;
+    const uint32_t rateWindow = 10000; // ms
+    const float rateSmoothing = 0.3; // ema factor, 1 -> no smoothing
+    float smoothedRate = 0; // L/min
+
+    bool valveOpen = false;
+    uint32_t valveChangedAt = 0;
+
+    const uint32_t leakWindow = 5000; // ms
+    const uint32_t leakSettleTime = 10000; // ms after closing, line draining
+    const uint64_t minLeakPulses = 5;
+    const uint32_t noFlowWindow = 10000; // ms
+    const uint32_t noFlowGraceTime = 20000; // ms after opening
+
+    bool leakReported = false;
+    bool noFlowReported = false;
+    std::atomic<int> pendingEvent = {FLOW_EVENT_NONE};
+
+    const FlowSample& sampleAt(int age); // 0 -> newest
+    uint64_t pulsesInWindow(uint32_t window, uint32_t &elapsed);
+    void checkEvents(uint32_t timestamp);
+  public:
+    void begin(int pulsesPerLiterSensor);
+    void addSample(uint64_t totalPulses, uint32_t timestamp);
+    void setValveState(bool open);
+    float getFlowRate(); // L/min
+    FlowEvent takeEvent();
+};
+
+#endif
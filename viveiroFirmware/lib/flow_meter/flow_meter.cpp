@@ -0,0 +1,100 @@
+#include "flow_meter.hpp"
+
+#ifdef FLOW_METER_ISR_BACKEND
+
+volatile uint64_t FlowMeter::isrPulses = 0;
+volatile uint32_t FlowMeter::lastPulseMicros = 0;
+uint32_t FlowMeter::minPulseInterval = 0;
+portMUX_TYPE FlowMeter::isrMux = portMUX_INITIALIZER_UNLOCKED;
+
+void IRAM_ATTR FlowMeter::pulseCounter()
+{
+  uint32_t now = micros();
+
+  taskENTER_CRITICAL_ISR(&isrMux);
+  if(now - lastPulseMicros >= minPulseInterval)
+  {
+    isrPulses++;
+    lastPulseMicros = now;
+  }
+  taskEXIT_CRITICAL_ISR(&isrMux);
+}
+
+bool FlowMeter::begin(int pin, uint32_t debounceTime)
+{
+  minPulseInterval = debounceTime;
+  pinMode(pin, INPUT);
+  attachInterrupt(digitalPinToInterrupt(pin), FlowMeter::pulseCounter, RISING);
+  return true;
+}
+
+uint64_t FlowMeter::getTotalPulses()
+{
+  uint64_t pulses = 0;
+
+  taskENTER_CRITICAL(&isrMux);
+  pulses = isrPulses;
+  taskEXIT_CRITICAL(&isrMux);
+
+  return pulses;
+}
+
+#else
+
+bool IRAM_ATTR FlowMeter::onHighLimit(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t *eventData, void *context)
+{
+  FlowMeter *meter = static_cast<FlowMeter*>(context);
+
+  taskENTER_CRITICAL_ISR(&meter->mux);
+  meter->overflowPulses += eventData->watch_point_value; // hardware counter restarts from zero at the limit
+  taskEXIT_CRITICAL_ISR(&meter->mux);
+
+  return false;
+}
+
+bool FlowMeter::begin(int pin, uint32_t debounceTime)
+{
+  pcnt_unit_config_t unitConfig = {};
+  unitConfig.low_limit = -1;
+  unitConfig.high_limit = pcntHighLimit;
+
+  if(pcnt_new_unit(&unitConfig, &unit) != ESP_OK) return false;
+
+  pcnt_glitch_filter_config_t filterConfig = {};
+  filterConfig.max_glitch_ns = (debounceTime * 1000 < maxGlitchFilter) ? debounceTime * 1000 : maxGlitchFilter;
+  pcnt_unit_set_glitch_filter(unit, &filterConfig);
+
+  pcnt_chan_config_t channelConfig = {};
+  channelConfig.edge_gpio_num = pin;
+  channelConfig.level_gpio_num = -1;
+
+  if(pcnt_new_channel(unit, &channelConfig, &channel) != ESP_OK) return false;
+
+  pcnt_channel_set_edge_action(channel, PCNT_CHANNEL_EDGE_ACTION_INCREASE, PCNT_CHANNEL_EDGE_ACTION_HOLD); // rising edges only
+  pcnt_unit_add_watch_point(unit, pcntHighLimit);
+
+  pcnt_event_callbacks_t callbacks = {};
+  callbacks.on_reach = FlowMeter::onHighLimit;
+  pcnt_unit_register_event_callbacks(unit, &callbacks, this);
+
+  if(pcnt_unit_enable(unit) != ESP_OK) return false;
+  pcnt_unit_clear_count(unit);
+  return pcnt_unit_start(unit) == ESP_OK;
+}
+
+uint64_t FlowMeter::getTotalPulses()
+{
+  int count = 0;
+  uint64_t total = 0;
+
+  taskENTER_CRITICAL(&mux);
+  pcnt_unit_get_count(unit, &count);
+  total = overflowPulses + count;
+  if(total < lastTotal) total = lastTotal; // limit reached but overflow interrupt still pending
+  lastTotal = total;
+  taskEXIT_CRITICAL(&mux);
+
+  return total;
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef _FLOW_METER_HPP_
+#define _FLOW_METER_HPP_
+
+#include <Arduino.h>
+
+#ifndef FLOW_METER_ISR_BACKEND
+#include "driver/pulse_cnt.h"
+#endif
+
+// monotonic pulse counter for the water-flow sensor
+// default backend: PCNT peripheral, build with -D FLOW_METER_ISR_BACKEND for the per-pulse GPIO interrupt
+class FlowMeter
+{
+  private:
+#ifdef FLOW_METER_ISR_BACKEND
+    static volatile uint64_t isrPulses;
+    static volatile uint32_t lastPulseMicros;
+    static uint32_t minPulseInterval; // us
+    static portMUX_TYPE isrMux;
+
+    static void IRAM_ATTR pulseCounter();
+#else
+    static const int pcntHighLimit = 30000;
+    static const uint32_t maxGlitchFilter = 12000; // ns, esp32 limit is 1023 APB cycles (~12.7us)
+
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+    uint64_t lastTotal = 0;
+
+    pcnt_unit_handle_t unit = nullptr;
+    pcnt_channel_handle_t channel = nullptr;
+    volatile uint64_t overflowPulses = 0;
+
+    static bool IRAM_ATTR onHighLimit(pcnt_unit_handle_t unit, const pcnt_watch_event_data_t *eventData, void *context);
+#endif
+  public:
+    bool begin(int pin, uint32_t debounceTime); // debounceTime in us
+    uint64_t getTotalPulses();
+};
+
+#endif
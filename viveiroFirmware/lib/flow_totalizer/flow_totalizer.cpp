@@ -0,0 +1,121 @@
+#include "flow_totalizer.hpp"
+
+RTC_NOINIT_ATTR static FlowStage rtcStage;
+
+FlowTotalizer *FlowTotalizer::instance = nullptr;
+
+uint32_t FlowTotalizer::stageCrc(FlowStage &stage)
+{
+  return esp_rom_crc32_le(0, (const uint8_t*)&stage.totalPulses, sizeof(stage.totalPulses) + sizeof(stage.eventStartPulses));
+}
+
+bool FlowTotalizer::begin(Peripheral &peripheral, DataManager &dataObj, uint32_t checkpointPulses)
+{
+  sensors = &peripheral;
+  dataManager = &dataObj;
+  minCheckpointPulses = checkpointPulses;
+
+  bool fromFlash = dataManager->loadFlowCheckpoint(lastCheckpoint);
+  if(!fromFlash) lastCheckpoint = {};
+
+  bool fromStage = rtcStage.magic == stageMagic && rtcStage.crc == stageCrc(rtcStage);
+
+  uint64_t totalPulses = lastCheckpoint.totalPulses;
+  uint64_t eventStartPulses = lastCheckpoint.eventStartPulses;
+
+  // the count only grows, a stage at or above the checkpoint is the newer copy
+  restoredFromStage = fromStage && rtcStage.totalPulses >= lastCheckpoint.totalPulses;
+  if(restoredFromStage)
+  {
+    totalPulses = rtcStage.totalPulses;
+    eventStartPulses = rtcStage.eventStartPulses;
+  }
+  sensors->restorePulses(totalPulses, eventStartPulses);
+
+  lastCheckpointAt = millis();
+  stage();
+
+  if(instance == nullptr)
+  {
+    instance = this;
+    esp_register_shutdown_handler(onShutdown);
+  }
+  return fromFlash || fromStage;
+}
+
+void FlowTotalizer::onShutdown()
+{
+  if(instance != nullptr) instance->stage();
+}
+
+void FlowTotalizer::stage()
+{
+  uint64_t totalPulses = sensors->getTotalPulses();
+  uint64_t eventStartPulses = sensors->getEventStartPulses();
+
+  portENTER_CRITICAL(&mux);
+  stagedTotal = totalPulses;
+  stagedEventStart = eventStartPulses;
+
+  rtcStage.magic = 0; // a reset mid-update leaves an invalid stage, not a mixed one
+  rtcStage.totalPulses = totalPulses;
+  rtcStage.eventStartPulses = eventStartPulses;
+  rtcStage.crc = stageCrc(rtcStage);
+  rtcStage.magic = stageMagic;
+  portEXIT_CRITICAL(&mux);
+}
+
+bool FlowTotalizer::checkpoint(uint32_t now)
+{
+  FlowCheckpoint next = {};
+
+  portENTER_CRITICAL(&mux);
+  next.totalPulses = stagedTotal;
+  next.eventStartPulses = stagedEventStart;
+  portEXIT_CRITICAL(&mux);
+
+  uint64_t pending = next.totalPulses - lastCheckpoint.totalPulses;
+  bool eventReported = next.eventStartPulses != lastCheckpoint.eventStartPulses; // once per event, a brownout must not resend it
+  uint32_t elapsed = now - lastCheckpointAt;
+
+  if(pending == 0 && !eventReported) return false;
+  if(!eventReported && elapsed < minCheckpointInterval) return false;
+  if(!eventReported && pending < minCheckpointPulses && elapsed < maxCheckpointInterval) return false;
+
+  next.sequence = lastCheckpoint.sequence + 1;
+  lastCheckpointAt = now; // a failed write also waits for the next interval
+
+  if(!dataManager->storeFlowCheckpoint(next))
+  {
+    checkpointFailures++;
+    return false;
+  }
+  lastCheckpoint = next;
+  checkpoints++;
+  return true;
+}
+
+uint64_t FlowTotalizer::getTotalPulses()
+{
+  uint64_t total;
+
+  portENTER_CRITICAL(&mux);
+  total = stagedTotal;
+  portEXIT_CRITICAL(&mux);
+  return total;
+}
+
+bool FlowTotalizer::wasRestoredFromStage()
+{
+  return restoredFromStage;
+}
+
+uint32_t FlowTotalizer::getCheckpointCount()
+{
+  return checkpoints;
+}
+
+uint32_t FlowTotalizer::getCheckpointFailures()
+{
+  return checkpointFailures;
+}
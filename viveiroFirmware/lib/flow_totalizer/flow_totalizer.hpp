@@ -0,0 +1,57 @@
+#ifndef _FLOW_TOTALIZER_HPP_
+#define _FLOW_TOTALIZER_HPP_
+
+#include <Arduino.h>
+#include "esp_system.h"
+#include "esp_attr.h"
+#include "esp_rom_crc.h"
+#include "data_manager.hpp"
+#include "peripheral_control.hpp"
+
+// copy of the live count in RTC memory, survives every reset except a power loss
+typedef struct
+{
+  uint32_t magic;
+  uint32_t crc; // of the two counters
+  uint64_t totalPulses;
+  uint64_t eventStartPulses;
+}FlowStage;
+
+// cumulative water volume that survives resets
+// the count is staged in RTC memory on every sample, flash checkpoints are rate-limited and rotate over the DataManager journal slots
+class FlowTotalizer
+{
+  private:
+    static const uint32_t stageMagic = 0x464C4F57;        // "FLOW"
+    static const uint32_t minCheckpointInterval = 60000;  // ms between flash writes while water runs
+    static const uint32_t maxCheckpointInterval = 900000; // ms, below minCheckpointPulses the residue still gets written
+
+    static FlowTotalizer *instance; // shutdown handler has no argument
+
+    Peripheral *sensors;
+    DataManager *dataManager;
+    uint32_t minCheckpointPulses = 450; // about a liter
+
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+    uint64_t stagedTotal = 0;
+    uint64_t stagedEventStart = 0;
+
+    FlowCheckpoint lastCheckpoint = {};
+    uint32_t lastCheckpointAt = 0; // ms
+    uint32_t checkpoints = 0;
+    uint32_t checkpointFailures = 0;
+    bool restoredFromStage = false;
+
+    static void onShutdown(); // esp_restart(), stages the count one last time
+    static uint32_t stageCrc(FlowStage &stage);
+  public:
+    bool begin(Peripheral &peripheral, DataManager &dataObj, uint32_t checkpointPulses); // restores the count, false on a blank unit
+    void stage();                   // any task, RTC memory only
+    bool checkpoint(uint32_t now);  // task that owns DataManager, true when a slot was written
+    uint64_t getTotalPulses();      // as last staged
+    bool wasRestoredFromStage();    // soft reset, nothing came from flash
+    uint32_t getCheckpointCount();
+    uint32_t getCheckpointFailures();
+};
+
+#endif
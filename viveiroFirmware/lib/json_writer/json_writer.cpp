@@ -0,0 +1,186 @@
+#include "json_writer.hpp"
+
+JsonBufferWriter::JsonBufferWriter(char *outputBuffer, size_t bufferSize)
+{
+  buffer = outputBuffer;
+  capacity = bufferSize;
+  reset();
+}
+
+void JsonBufferWriter::append(const char *text, size_t length)
+{
+  if(overflowed) return;
+  if(position + length >= capacity) // keep room for the terminator
+  {
+    overflowed = true;
+    return;
+  }
+  memcpy(buffer + position, text, length);
+  position += length;
+  buffer[position] = '\0';
+}
+
+void JsonBufferWriter::append(char character)
+{
+  append(&character, 1);
+}
+
+void JsonBufferWriter::separator()
+{
+  if(afterKey)
+  {
+    afterKey = false;
+    return;
+  }
+  if(needsComma[depth]) append(',');
+  needsComma[depth] = true;
+}
+
+void JsonBufferWriter::open(char bracket)
+{
+  separator();
+  append(bracket);
+  if(depth < maxDepth - 1) depth++;
+  else overflowed = true;
+  needsComma[depth] = false;
+}
+
+void JsonBufferWriter::close(char bracket)
+{
+  append(bracket);
+  if(depth > 0) depth--;
+}
+
+void JsonBufferWriter::beginArray()
+{
+  open('[');
+}
+
+void JsonBufferWriter::endArray()
+{
+  close(']');
+}
+
+void JsonBufferWriter::beginObject()
+{
+  open('{');
+}
+
+void JsonBufferWriter::endObject()
+{
+  close('}');
+}
+
+void JsonBufferWriter::key(const char *name)
+{
+  value(name);
+  append(':');
+  afterKey = true;
+}
+
+void JsonBufferWriter::value(const char *text)
+{
+  separator();
+  append('"');
+  for(const char *c = text; *c != '\0'; c++)
+  {
+    switch(*c)
+    {
+      case '"':  append("\\\"", 2); break;
+      case '\\': append("\\\\", 2); break;
+      case '\n': append("\\n", 2); break;
+      case '\r': append("\\r", 2); break;
+      case '\t': append("\\t", 2); break;
+      default:
+        if((uint8_t)*c < 0x20)
+        {
+          char escaped[7];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", *c);
+          append(escaped, 6);
+        }
+        else
+        {
+          append(*c);
+        }
+    }
+  }
+  append('"');
+}
+
+void JsonBufferWriter::value(int number)
+{
+  value((long)number);
+}
+
+void JsonBufferWriter::value(unsigned int number)
+{
+  value((unsigned long)number);
+}
+
+void JsonBufferWriter::value(long number)
+{
+  char text[24];
+  separator();
+  append(text, snprintf(text, sizeof(text), "%ld", number));
+}
+
+void JsonBufferWriter::value(unsigned long number)
+{
+  char text[24];
+  separator();
+  append(text, snprintf(text, sizeof(text), "%lu", number));
+}
+
+void JsonBufferWriter::value(float number, int decimals)
+{
+  value((double)number, decimals);
+}
+
+void JsonBufferWriter::value(double number, int decimals)
+{
+  char text[24];
+  separator();
+  if(isnan(number) || isinf(number))
+  {
+    append("null", 4);
+    return;
+  }
+  int length = snprintf(text, sizeof(text), "%.*f", decimals, number);
+  if(length < 0 || length >= (int)sizeof(text))
+  {
+    overflowed = true; // a cut number still parses, as the wrong value
+    return;
+  }
+  append(text, length);
+}
+
+void JsonBufferWriter::raw(const char *text, size_t length)
+{
+  separator();
+  append(text, length);
+}
+
+const char* JsonBufferWriter::data()
+{
+  return buffer;
+}
+
+size_t JsonBufferWriter::length()
+{
+  return position;
+}
+
+bool JsonBufferWriter::ok()
+{
+  return !overflowed;
+}
+
+void JsonBufferWriter::reset()
+{
+  position = 0;
+  overflowed = false;
+  depth = 0;
+  needsComma[0] = false;
+  afterKey = false;
+  if(capacity > 0) buffer[0] = '\0';
+}
@@ -0,0 +1,50 @@
+#ifndef _JSON_WRITER_HPP_
+#define _JSON_WRITER_HPP_
+
+#include <Arduino.h>
+
+// append-only JSON serializer into a caller-owned buffer, no heap allocation
+class JsonBufferWriter
+{
+  private:
+    static const int maxDepth = 8;
+
+    char *buffer;
+    size_t capacity;
+    size_t position = 0;
+    bool overflowed = false;
+
+    int depth = 0;
+    bool needsComma[maxDepth] = {};
+    bool afterKey = false;
+
+    void append(const char *text, size_t length);
+    void append(char character);
+    void separator();
+    void open(char bracket);
+    void close(char bracket);
+  public:
+    JsonBufferWriter(char *outputBuffer, size_t bufferSize);
+
+    void beginArray();
+    void endArray();
+    void beginObject();
+    void endObject();
+
+    void key(const char *name);
+    void value(const char *text);
+    void value(int number);
+    void value(unsigned int number);
+    void value(long number);
+    void value(unsigned long number);
+    void value(float number, int decimals = 2);
+    void value(double number, int decimals = 3);
+    void raw(const char *text, size_t length); // pre-serialized value
+
+    const char* data();
+    size_t length();
+    bool ok(); // false if the buffer was too small
+    void reset();
+};
+
+#endif
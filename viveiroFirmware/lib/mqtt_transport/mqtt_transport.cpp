@@ -0,0 +1,171 @@
+#include "mqtt_transport.hpp"
+
+bool MqttTransport::begin(const String &uri, TaskHandle_t taskToNotify)
+{
+  if(uri.length() == 0) return false;
+
+  brokerUri = uri;
+  notifyTask = taskToNotify;
+  if(ackSignal == nullptr) ackSignal = xSemaphoreCreateBinary();
+  if(ackSignal == nullptr) return false;
+
+  uint64_t mac = ESP.getEfuseMac();
+  snprintf(clientId, sizeof(clientId), "viveiro-%012llx", mac);
+  snprintf(topicBase, sizeof(topicBase), "viveiro/%012llx", mac);
+  buildTopic(statusTopic, sizeof(statusTopic), "status");
+
+  esp_mqtt_client_config_t config = {};
+  config.broker.address.uri = brokerUri.c_str();
+  config.credentials.client_id = clientId;
+  config.session.keepalive = keepAlive;
+  config.session.disable_clean_session = true; // broker keeps qos 1 commands while we are away
+  config.session.last_will.topic = statusTopic;
+  config.session.last_will.msg = "offline";
+  config.session.last_will.qos = qos;
+  config.session.last_will.retain = 1;
+  config.network.reconnect_timeout_ms = reconnectTimeout;
+  config.buffer.out_size = outBufferSize;
+
+  client = esp_mqtt_client_init(&config);
+  if(client == nullptr) return false;
+
+  esp_mqtt_client_register_event(client, MQTT_EVENT_ANY, eventHandler, this);
+  return esp_mqtt_client_start(client) == ESP_OK;
+}
+
+void MqttTransport::eventHandler(void *handlerArgs, esp_event_base_t base, int32_t eventId, void *eventData)
+{
+  MqttTransport *transport = (MqttTransport*)handlerArgs;
+  esp_mqtt_event_handle_t event = (esp_mqtt_event_handle_t)eventData;
+
+  switch((esp_mqtt_event_id_t)eventId)
+  {
+    case MQTT_EVENT_CONNECTED:
+      transport->onConnected();
+    break;
+
+    case MQTT_EVENT_DISCONNECTED:
+      transport->connected.store(false);
+    break;
+
+    case MQTT_EVENT_DATA:
+      transport->onData(event);
+    break;
+
+    case MQTT_EVENT_PUBLISHED: // puback of a qos 1 publish
+      transport->lastAckedId.store(event->msg_id);
+      xSemaphoreGive(transport->ackSignal);
+    break;
+
+    default:
+    break;
+  }
+}
+
+void MqttTransport::onConnected() // esp-mqtt task
+{
+  char topic[48];
+
+  buildTopic(topic, sizeof(topic), "valve");
+  esp_mqtt_client_subscribe(client, topic, qos);
+  buildTopic(topic, sizeof(topic), "schedule");
+  esp_mqtt_client_subscribe(client, topic, qos);
+
+  esp_mqtt_client_publish(client, statusTopic, "online", 0, qos, 1);
+  connects++;
+  connected.store(true);
+}
+
+void MqttTransport::onData(esp_mqtt_event_handle_t event) // esp-mqtt task
+{
+  if(event->current_data_offset != 0) return; // commands fit in one fragment
+
+  messagesReceived++;
+
+  if(topicIs(event, "valve"))
+  {
+    bool on = (event->data_len == 4 && strncmp(event->data, "true", 4) == 0) || (event->data_len == 1 && event->data[0] == '1');
+    bool off = (event->data_len == 5 && strncmp(event->data, "false", 5) == 0) || (event->data_len == 1 && event->data[0] == '0');
+    if(!on && !off) return;
+    pendingValveState.store(on ? 1 : 0);
+  }
+  else if(topicIs(event, "schedule"))
+  {
+    scheduleChanged.store(true); // body is fetched over http, same parser and etag
+  }
+  else
+  {
+    return;
+  }
+
+  if(notifyTask != nullptr) xTaskNotifyGive(notifyTask);
+}
+
+bool MqttTransport::topicIs(esp_mqtt_event_handle_t event, const char *suffix)
+{
+  char topic[48];
+
+  buildTopic(topic, sizeof(topic), suffix);
+  return event->topic_len == (int)strlen(topic) && strncmp(event->topic, topic, event->topic_len) == 0;
+}
+
+void MqttTransport::buildTopic(char *topic, size_t size, const char *suffix)
+{
+  snprintf(topic, size, "%s/%s", topicBase, suffix);
+}
+
+bool MqttTransport::isEnabled()
+{
+  return client != nullptr;
+}
+
+bool MqttTransport::isConnected()
+{
+  return client != nullptr && connected.load();
+}
+
+bool MqttTransport::publish(const char *suffix, const char *data, size_t length)
+{
+  char topic[48];
+
+  if(!isConnected()) return false;
+
+  buildTopic(topic, sizeof(topic), suffix);
+  xSemaphoreTake(ackSignal, 0); // drop a give left by an earlier ack
+  int msgId = esp_mqtt_client_publish(client, topic, data, length, qos, 0);
+  if(msgId < 0) return false;
+
+  // queued is not delivered, a drop before the puback would lose the data
+  uint32_t startedAt = millis();
+  while(lastAckedId.load() != msgId)
+  {
+    uint32_t elapsed = millis() - startedAt;
+    if(elapsed >= ackTimeout || !isConnected()) return false;
+    xSemaphoreTake(ackSignal, pdMS_TO_TICKS(ackTimeout - elapsed));
+  }
+  return true;
+}
+
+bool MqttTransport::takeValveState(int &valveState)
+{
+  int state = pendingValveState.exchange(-1);
+  if(state < 0) return false;
+
+  valveState = state;
+  return true;
+}
+
+bool MqttTransport::takeScheduleChanged()
+{
+  return scheduleChanged.exchange(false);
+}
+
+uint32_t MqttTransport::getConnectCount()
+{
+  return connects.load();
+}
+
+uint32_t MqttTransport::getMessageCount()
+{
+  return messagesReceived.load();
+}
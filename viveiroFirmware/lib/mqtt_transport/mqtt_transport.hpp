@@ -0,0 +1,51 @@
+#ifndef _MQTT_TRANSPORT_HPP_
+#define _MQTT_TRANSPORT_HPP_
+
+#include <Arduino.h>
+#include <atomic>
+#include "mqtt_client.h"
+
+// optional push channel next to the HTTP api, topics viveiro/<device>/{valve,schedule,sensors,flow,status}
+class MqttTransport
+{
+  private:
+    static const int qos = 1;
+    static const int keepAlive = 30;             // s
+    static const int reconnectTimeout = 5000;    // ms, esp-mqtt retries forever
+    static const int outBufferSize = 2048;       // sensor batches
+    static const uint32_t ackTimeout = 3000;     // ms, publish waits this long for the puback
+
+    esp_mqtt_client_handle_t client = nullptr;
+    TaskHandle_t notifyTask = nullptr;
+    SemaphoreHandle_t ackSignal = nullptr; // given on every puback
+
+    String brokerUri;
+    char clientId[24] = {};
+    char topicBase[32] = {};
+    char statusTopic[48] = {};
+
+    std::atomic<bool> connected = {0};
+    std::atomic<int> pendingValveState = {-1};
+    std::atomic<bool> scheduleChanged = {0};
+    std::atomic<int> lastAckedId = {-1};
+    std::atomic<uint32_t> connects = {0};
+    std::atomic<uint32_t> messagesReceived = {0};
+
+    static void eventHandler(void *handlerArgs, esp_event_base_t base, int32_t eventId, void *eventData);
+    void onConnected();
+    void onData(esp_mqtt_event_handle_t event);
+    bool topicIs(esp_mqtt_event_handle_t event, const char *suffix);
+    void buildTopic(char *topic, size_t size, const char *suffix);
+  public:
+    bool begin(const String &uri, TaskHandle_t taskToNotify); // empty uri -> disabled
+    bool isEnabled();
+    bool isConnected();
+    bool publish(const char *suffix, const char *data, size_t length); // true once the broker acked, false -> caller falls back to http
+
+    bool takeValveState(int &valveState); // last pushed command, 1/0
+    bool takeScheduleChanged();
+    uint32_t getConnectCount();
+    uint32_t getMessageCount();
+};
+
+#endif
@@ -0,0 +1,266 @@
+#include "offline_queue.hpp"
+#include "esp_rom_crc.h"
+#include <stddef.h>
+
+bool OfflineQueue::begin(const char *label)
+{
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+  if(partition == nullptr) return false;
+
+  numSectors = partition->size / sectorSize;
+  if(numSectors < 2) 
+  {
+    partition = nullptr;
+    return false;
+  }
+  scan();
+  return true;
+}
+
+uint32_t OfflineQueue::sectorOf(uint32_t offset)
+{
+  return (offset / sectorSize) % numSectors;
+}
+
+uint32_t OfflineQueue::align(uint32_t length)
+{
+  return (length + 3) & ~3u;
+}
+
+uint32_t OfflineQueue::recordCrc(RecordHeader &header, const uint8_t *payload)
+{
+  uint32_t fields[3] = {header.type, header.length, header.timestamp};
+  uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)fields, sizeof(fields));
+
+  return esp_rom_crc32_le(crc, payload, header.length);
+}
+
+bool OfflineQueue::readSectorHeader(uint32_t sector, SectorHeader &header)
+{
+  if(esp_partition_read(partition, sector * sectorSize, &header, sizeof(SectorHeader)) != ESP_OK) return false;
+  return header.magic == sectorMagic;
+}
+
+bool OfflineQueue::openSector(uint32_t sector, uint32_t sequence)
+{
+  SectorHeader header = {sectorMagic, sequence, erased, erased};
+
+  if(esp_partition_erase_range(partition, sector * sectorSize, sectorSize) != ESP_OK) return false;
+  return esp_partition_write(partition, sector * sectorSize, &header, sizeof(SectorHeader)) == ESP_OK;
+}
+
+bool OfflineQueue::locate(uint32_t &offset, RecordHeader &header)
+{
+  for(uint32_t hops = 0; hops <= numSectors; hops++)
+  {
+    if(offset == headOffset) return false;
+
+    if(offset % sectorSize == 0) // end of a full sector
+    {
+      offset = sectorOf(offset) * sectorSize + sectorHeaderSize;
+      continue;
+    }
+
+    uint32_t sectorEnd = (sectorOf(offset) + 1) * sectorSize;
+    if(offset + recordHeaderSize <= sectorEnd)
+    {
+      esp_partition_read(partition, offset, &header, sizeof(RecordHeader));
+      if(header.magic == recordMagic && offset + recordHeaderSize + align(header.length) <= sectorEnd) return true;
+    }
+    offset = ((sectorOf(offset) + 1) % numSectors) * sectorSize + sectorHeaderSize; // end of data in this sector
+  }
+  return false;
+}
+
+void OfflineQueue::scan()
+{
+  SectorHeader sectorHeader;
+  RecordHeader header;
+  bool found = false;
+  uint32_t newestSector = 0;
+
+  for(uint32_t sector = 0; sector < numSectors; sector++)
+  {
+    if(!readSectorHeader(sector, sectorHeader)) continue;
+    if(!found || sectorHeader.sequence > headSequence)
+    {
+      headSequence = sectorHeader.sequence;
+      newestSector = sector;
+    }
+    found = true;
+  }
+
+  if(!found) // blank partition
+  {
+    headSequence = 1;
+    openSector(0, headSequence);
+    headOffset = tailOffset = sectorHeaderSize;
+    pendingRecords = 0;
+    return;
+  }
+
+  uint32_t sectorEnd = (newestSector + 1) * sectorSize;
+  uint32_t offset = newestSector * sectorSize + sectorHeaderSize;
+  while(offset + recordHeaderSize <= sectorEnd)
+  {
+    esp_partition_read(partition, offset, &header, sizeof(RecordHeader));
+    if(header.magic != recordMagic) 
+    {
+      if(header.magic != (uint16_t)erased) offset = sectorEnd; // torn write, area no longer programmable
+      break;
+    }
+    if(offset + recordHeaderSize + align(header.length) > sectorEnd)
+    {
+      offset = sectorEnd;
+      break;
+    }
+    offset += recordHeaderSize + align(header.length);
+  }
+  headOffset = min(offset, sectorEnd);
+
+  // oldest sector follows the newest one in the ring
+  bool tailFound = false;
+  tailOffset = headOffset;
+  pendingRecords = 0;
+
+  for(uint32_t i = 1; i <= numSectors; i++)
+  {
+    uint32_t sector = (newestSector + i) % numSectors;
+    if(!readSectorHeader(sector, sectorHeader) || sectorHeader.drained != erased) continue;
+
+    sectorEnd = (sector + 1) * sectorSize;
+    offset = sector * sectorSize + sectorHeaderSize;
+    while(offset != headOffset && offset + recordHeaderSize <= sectorEnd)
+    {
+      esp_partition_read(partition, offset, &header, sizeof(RecordHeader));
+      if(header.magic != recordMagic || offset + recordHeaderSize + align(header.length) > sectorEnd) break;
+
+      if(header.consumed == erased)
+      {
+        if(!tailFound) tailOffset = offset;
+        tailFound = true;
+        pendingRecords++;
+      }
+      offset += recordHeaderSize + align(header.length);
+    }
+  }
+}
+
+bool OfflineQueue::push(uint8_t type, uint32_t timestamp, const uint8_t *payload, size_t length)
+{
+  uint32_t total = recordHeaderSize + align(length);
+  
+  if(partition == nullptr || total + sectorHeaderSize > sectorSize) return false;
+
+  if(headOffset % sectorSize + total > sectorSize || headOffset % sectorSize == 0) // head sector full
+  {
+    uint32_t sector = (sectorOf(headOffset - 1) + 1) % numSectors;
+    RecordHeader header;
+
+    if(pendingRecords > 0 && sectorOf(tailOffset) == sector) // ring full, drop the oldest sector
+    {
+      uint32_t offset = tailOffset;
+      while(locate(offset, header) && sectorOf(offset) == sector)
+      {
+        droppedRecords++;
+        pendingRecords--;
+        offset += recordHeaderSize + align(header.length);
+      }
+      tailOffset = ((sector + 1) % numSectors) * sectorSize + sectorHeaderSize;
+    }
+
+    if(!openSector(sector, ++headSequence)) return false;
+    headOffset = sector * sectorSize + sectorHeaderSize;
+  }
+
+  if(pendingRecords == 0) tailOffset = headOffset;
+
+  RecordHeader header = {};
+  header.magic = recordMagic;
+  header.type = type;
+  header.length = length;
+  header.timestamp = timestamp;
+  header.crc = recordCrc(header, payload);
+  header.consumed = erased;
+
+  if(esp_partition_write(partition, headOffset, &header, sizeof(RecordHeader)) != ESP_OK) return false;
+  if(esp_partition_write(partition, headOffset + recordHeaderSize, payload, length) != ESP_OK) return false;
+
+  headOffset += total;
+  pendingRecords++;
+  return true;
+}
+
+uint32_t OfflineQueue::readCursor()
+{
+  return tailOffset;
+}
+
+bool OfflineQueue::read(uint32_t &cursor, QueueRecord &record, uint8_t *payload, size_t maxLength)
+{
+  RecordHeader header;
+
+  if(partition == nullptr || !locate(cursor, header)) return false;
+
+  record.type = header.type;
+  record.timestamp = header.timestamp;
+  record.length = header.length;
+  record.valid = false;
+
+  if(header.length <= maxLength)
+  {
+    esp_partition_read(partition, cursor + recordHeaderSize, payload, header.length);
+    record.valid = recordCrc(header, payload) == header.crc;
+  }
+  cursor += recordHeaderSize + align(header.length);
+  return true;
+}
+
+bool OfflineQueue::peekType(uint32_t cursor, uint8_t &type)
+{
+  RecordHeader header;
+
+  if(partition == nullptr || !locate(cursor, header)) return false;
+  type = header.type;
+  return true;
+}
+
+void OfflineQueue::consumeUntil(uint32_t cursor)
+{
+  RecordHeader header;
+  uint32_t offset = tailOffset;
+  const uint32_t consumed = 0;
+
+  if(partition == nullptr) return;
+
+  while(offset != cursor && locate(offset, header))
+  {
+    esp_partition_write(partition, offset + offsetof(RecordHeader, consumed), &consumed, sizeof(consumed));
+    if(pendingRecords > 0) pendingRecords--;
+    offset += recordHeaderSize + align(header.length);
+  }
+  advanceTail(offset);
+}
+
+void OfflineQueue::advanceTail(uint32_t offset)
+{
+  const uint32_t drained = 0;
+  uint32_t sector = sectorOf(tailOffset);
+
+  while(sector != sectorOf(offset) && sector != sectorOf(headOffset)) // sectors left behind are fully sent
+  {
+    esp_partition_write(partition, sector * sectorSize + offsetof(SectorHeader, drained), &drained, sizeof(drained));
+    sector = (sector + 1) % numSectors;
+  }
+  tailOffset = (pendingRecords == 0) ? headOffset : offset;
+}
+
+uint32_t OfflineQueue::size()
+{
+  return pendingRecords;
+}
+
+uint32_t OfflineQueue::getDroppedRecords()
+{
+  return droppedRecords;
+}
@@ -0,0 +1,86 @@
+#ifndef _OFFLINE_QUEUE_HPP_
+#define _OFFLINE_QUEUE_HPP_
+
+#include <Arduino.h>
+#include "esp_partition.h"
+
+typedef enum
+{
+  QUEUE_RECORD_SENSORS = 1,
+  QUEUE_RECORD_WATER_VOLUME = 2,
+  QUEUE_RECORD_SENSORS_CBOR = 3,
+  QUEUE_RECORD_WATER_VOLUME_CBOR = 4,
+  QUEUE_RECORD_FLOW_EVENT = 5 // json only, to the water flow endpoint
+}QueueRecordType;
+
+typedef struct
+{
+  uint8_t type;
+  uint32_t timestamp; // epoch s, 0 -> time unknown
+  uint16_t length;
+  bool valid;         // crc ok
+}QueueRecord;
+
+// append-only log of failed uploads in the "upqueue" flash partition
+// each sector starts with a header (sequence, drained flag), records carry a crc and a consumed word
+class OfflineQueue
+{
+  private:
+    static const uint32_t sectorSize = 4096;
+    static const uint32_t sectorMagic = 0x51555056; // "VPUQ"
+    static const uint16_t recordMagic = 0x5152;
+    static const uint32_t sectorHeaderSize = 16;
+    static const uint32_t recordHeaderSize = 20;
+    static const uint32_t erased = 0xFFFFFFFF;
+
+    typedef struct
+    {
+      uint32_t magic;
+      uint32_t sequence;
+      uint32_t drained;
+      uint32_t reserved;
+    }SectorHeader;
+
+    typedef struct
+    {
+      uint16_t magic;
+      uint8_t type;
+      uint8_t reserved;
+      uint16_t length;
+      uint16_t reserved2;
+      uint32_t timestamp;
+      uint32_t crc;
+      uint32_t consumed;
+    }RecordHeader;
+
+    const esp_partition_t *partition = nullptr;
+    uint32_t numSectors = 0;
+
+    uint32_t headOffset = 0;     // next write position
+    uint32_t headSequence = 0;   // sequence of the head sector
+    uint32_t tailOffset = 0;     // oldest unconsumed record
+    uint32_t pendingRecords = 0;
+    uint32_t droppedRecords = 0;
+
+    uint32_t sectorOf(uint32_t offset);
+    uint32_t align(uint32_t length);
+    uint32_t recordCrc(RecordHeader &header, const uint8_t *payload);
+    bool readSectorHeader(uint32_t sector, SectorHeader &header);
+    bool openSector(uint32_t sector, uint32_t sequence);
+    bool locate(uint32_t &offset, RecordHeader &header); // first record at or after offset, false at head
+    void advanceTail(uint32_t offset);
+    void scan();
+  public:
+    bool begin(const char *label = "upqueue");
+    bool push(uint8_t type, uint32_t timestamp, const uint8_t *payload, size_t length);
+
+    uint32_t readCursor(); // tail
+    bool read(uint32_t &cursor, QueueRecord &record, uint8_t *payload, size_t maxLength); // advances cursor
+    bool peekType(uint32_t cursor, uint8_t &type);
+    void consumeUntil(uint32_t cursor); // marks every record before cursor as sent
+
+    uint32_t size();
+    uint32_t getDroppedRecords();
+};
+
+#endif
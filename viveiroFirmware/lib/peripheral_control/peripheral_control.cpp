@@ -1,48 +1,176 @@
 #include "esp32-hal-gpio.h"
 #include "peripheral_control.hpp"
 
-//volatile uint64_t Peripheral::fluxPulses = 0;
-std::atomic<uint32_t> Peripheral::fluxPulses = {0};
-
-void IRAM_ATTR Peripheral::fluxCounter()
-{
-  //taskENTER_CRITICAL_ISR(&mux);
-  //fluxPulses++;
-  //taskEXIT_CRITICAL_ISR(&mux);
-  fluxPulses.fetch_add(1,std::memory_order_relaxed);
-}
-
 void Peripheral::analogReadAbsolute(int absoluteHumiArray[], int numSensors)
 {
+  uint32_t scanStart = millis();
   int startPin = 3;  // ports 0, 1 and 2 of the multiplex are disabled (pcb limits)
   numSensors = min(numSensors, 5); // max num sensors (pcb limits)
   
   for (int port = startPin; port < numSensors + startPin; port++ ) // ports 0, 1 and 2 of the multiplex are disabled (pcb limits)
   {
-    absoluteHumiArray[mapSensors[port-startPin]] = 0;
+    int sensor = mapSensors[port-startPin];
+    
+    absoluteHumiArray[sensor] = 0;
     for (int numberBit = 0; numberBit < 3; numberBit++)
     {
       digitalWrite(MultiplexPins[numberBit], multiplexBitLevel[port][numberBit]);
     }
-    for(int i = 0; i<numSamplesAnalogRead; i++)
+
+    if(adcSampler.isReady() && adcSampler.sample(humidityReadings[sensor], muxSettleTime, numSamplesAdcBurst))
+    {
+      absoluteHumiArray[sensor] = humidityReadings[sensor].median;
+      continue;
+    }
+
+    for(int i = 0; i<numSamplesAnalogRead; i++) // fallback without the continuous driver or after a failed burst
     {
       delay(analogReadingTimeInterval);
-      absoluteHumiArray[mapSensors[port-startPin]] += analogRead(analogHumidityPin);
+      absoluteHumiArray[sensor] += analogRead(analogHumidityPin);
+    }
+    absoluteHumiArray[sensor] = absoluteHumiArray[sensor]/numSamplesAnalogRead;
+    humidityReadings[sensor] = {(uint16_t)absoluteHumiArray[sensor], (uint16_t)absoluteHumiArray[sensor], (uint16_t)numSamplesAnalogRead};
+  }
+
+  humiScanDuration.store(millis() - scanStart, std::memory_order_relaxed);
+}
+
+AdcReading Peripheral::getHumiReading(int sensor)
+{
+  return humidityReadings[sensor];
+}
+
+uint32_t Peripheral::getHumiScanDuration()
+{
+  return humiScanDuration.load(std::memory_order_relaxed);
+}
+
+void Peripheral::readProbesOnBus(int bus)
+{
+  for (int probe = 0; probe < probeTable.numProbes; probe++)
+  {
+    if(probeTable.bus[probe] != bus) continue;
+
+    if(probeTable.address[probe][0] == 0) // empty connector
+    {
+      tempValues[probe] = DEVICE_DISCONNECTED_C;
+      continue;
+    }
+    tempValues[probe] = tempSensors[bus].getTempC(probeTable.address[probe]);
+  }
+}
+
+void Peripheral::readTempSensors()
+{
+  uint32_t sweepStart = millis();
+
+  if(asyncTempConversion)
+  {
+    uint32_t conversionTime = 0;
+
+    for (int bus = 0; bus < hardwareLimit; bus++) // one broadcast conversion per bus, all buses at once
+    {
+      tempSensors[bus].requestTemperatures();
+      conversionTime = max(conversionTime, (uint32_t)tempSensors[bus].millisToWaitForConversion(tempSensors[bus].getResolution()));
+    }
+
+    uint32_t elapsed = millis() - sweepStart;
+    if(elapsed < conversionTime) 
+    {
+      vTaskDelay(pdMS_TO_TICKS(conversionTime - elapsed)); // yield while the probes convert
+    }
+
+    for (int bus = 0; bus < hardwareLimit; bus++)
+    {
+      readProbesOnBus(bus);
+    }
+  }
+  else
+  {
+    for (int bus = 0; bus < hardwareLimit; bus++)
+    {
+      tempSensors[bus].requestTemperatures();
+      readProbesOnBus(bus);
+      delay(500);
     }
-    absoluteHumiArray[mapSensors[port-startPin]] = absoluteHumiArray[mapSensors[port-startPin]]/numSamplesAnalogRead;
   }
+
+  tempSweepDuration.store(millis() - sweepStart, std::memory_order_relaxed);
+}
+
+uint32_t Peripheral::getTempSweepDuration()
+{
+  return tempSweepDuration.load(std::memory_order_relaxed);
 }
 
-void Peripheral::readTempSensors(float tempArray[], int numSensors)
+void Peripheral::discoverTempProbes(TempProbeTable &table)
 {
-  for (int sensor = 0; sensor < numSensors; sensor++)
+  DeviceAddress address;
+
+  table = {};
+  table.numProbes = hardwareLimit; // first probe of each bus keeps the connector index (D1-D5)
+  for (int bus = 0; bus < hardwareLimit; bus++)
   {
-    tempSensors[sensor].requestTemperatures();
-    tempArray[sensor] = tempSensors[sensor].getTempCByIndex(0);
-    delay(500);
+    table.bus[bus] = bus;
   }
+
+  for (int bus = 0; bus < hardwareLimit; bus++)
+  {
+    bool firstOnBus = true;
+
+    oneWire[bus].reset_search();
+    while(oneWire[bus].search(address))
+    {
+      if(!tempSensors[bus].validAddress(address) || !tempSensors[bus].validFamily(address)) continue;
+
+      int probe = bus;
+      if(!firstOnBus)
+      {
+        if(table.numProbes >= maxTempProbes) break;
+        probe = table.numProbes++;
+        table.bus[probe] = bus;
+      }
+      memcpy(table.address[probe], address, sizeof(DeviceAddress));
+      firstOnBus = false;
+    }
+  }
+  probeTable = table;
 }
 
+bool Peripheral::setTempProbes(TempProbeTable &table)
+{
+  int probesOnBus[hardwareLimit] = {};
+
+  if(table.numProbes < hardwareLimit || table.numProbes > maxTempProbes) return false;
+
+  for (int probe = 0; probe < table.numProbes; probe++)
+  {
+    int bus = table.bus[probe];
+    
+    if(bus >= hardwareLimit) return false;
+    if(table.address[probe][0] == 0) continue;
+    if(!tempSensors[bus].isConnected(table.address[probe])) return false;
+    probesOnBus[bus]++;
+  }
+
+  for (int bus = 0; bus < hardwareLimit; bus++) // probe added since the table was stored
+  {
+    if(probesOnBus[bus] != tempSensors[bus].getDS18Count()) return false;
+  }
+
+  probeTable = table;
+  return true;
+}
+
+int Peripheral::getNumTempProbes()
+{
+  return probeTable.numProbes;
+}
+
+float Peripheral::getTempProbeValue(int probe)
+{
+  return tempValues[probe];
+}
 
 void Peripheral::humiCalibration(Sensor sensors[], int numSensors, bool op)
 {
@@ -63,7 +191,7 @@ void Peripheral::humiCalibration(Sensor sensors[], int numSensors, bool op)
 
 void Peripheral::loadTempSensor(Sensor sensors[],  int numSensors)
 {
-  readTempSensors(tempValues, numSensors);
+  readTempSensors();
 
   for(int i = 0; i<numSensors;i++)
   {
@@ -87,8 +215,8 @@ void Peripheral::initPeripheral()
   pinMode(MultiplexPins[1], OUTPUT);
   pinMode(MultiplexPins[2], OUTPUT);
   pinMode(analogHumidityPin, INPUT);
+  if(!adcSampler.begin(analogHumidityPin)) Serial.println("adcContinuous_fail");
   pinMode(configPin, INPUT);
-  pinMode(flowSensorPin, INPUT);
   pinMode(relayPin, OUTPUT);
   digitalWrite(relayPin, LOW);
 
@@ -97,8 +225,9 @@ void Peripheral::initPeripheral()
     oneWire[i] = OneWire(tempSensorsPins[i]);
     tempSensors[i] = DallasTemperature(&oneWire[i]);
     tempSensors[i].begin();
+    tempSensors[i].setWaitForConversion(!asyncTempConversion);
   }
-  attachInterrupt(digitalPinToInterrupt(flowSensorPin), Peripheral::fluxCounter, RISING);
+  if(!flowMeter.begin(flowSensorPin, debaucingTime)) Serial.println("flowMeter_fail");
 }
 void Peripheral::powerValve(bool state)
 {
@@ -107,19 +236,33 @@ void Peripheral::powerValve(bool state)
 }
 void Peripheral::resetWaterVolume()
 {
-  //taskENTER_CRITICAL_ISR(&mux);
-  //fluxPulses = 0;
-  //taskEXIT_CRITICAL_ISR(&mux);
-  fluxPulses.store(0,std::memory_order_relaxed);
+  eventStartPulses.store(getTotalPulses());
 }
 
 double Peripheral::getWaterVolume()
 {
-  uint64_t pulses  = 0;
-  //taskENTER_CRITICAL_ISR(&mux);
-  //pulses = fluxPulses;
-  //taskEXIT_CRITICAL_ISR(&mux);
-  pulses = fluxPulses.load(std::memory_order_acquire);
+  uint64_t pulses  = getTotalPulses() - eventStartPulses.load();
 
   return static_cast<double>(pulses)/pulsesPerLiter;
+}
+
+uint64_t Peripheral::getTotalPulses()
+{
+  return pulseOffset.load() + flowMeter.getTotalPulses();
+}
+
+uint64_t Peripheral::getEventStartPulses()
+{
+  return eventStartPulses.load();
+}
+
+void Peripheral::restorePulses(uint64_t totalPulses, uint64_t eventStart)
+{
+  pulseOffset.store(totalPulses); // pulses since power-on add on top
+  eventStartPulses.store(eventStart > totalPulses ? totalPulses : eventStart);
+}
+
+int Peripheral::getPulsesPerLiter()
+{
+  return pulsesPerLiter;
 }
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include <OneWire.h>
 #include <DallasTemperature.h>
 #include "data_types.hpp"
+#include "adc_sampler.hpp"
+#include "flow_meter.hpp"
 #include <Arduino.h>
 #include <atomic>
 
@@ -20,18 +22,31 @@ class Peripheral
     const int analogHumidityPin = 32;
     const int pulsesPerLiter = 450;
 
-    const int debaucingTime = 100;
-    //static volatile uint64_t fluxPulses;
-    static std::atomic<uint32_t> fluxPulses;
+    const int debaucingTime = 10; // us, pcnt glitch filter / isr minimum pulse interval
 
-    int numSamplesAnalogRead = 3;
-    unsigned int analogReadingTimeInterval = 100; // ms
+    FlowMeter flowMeter;
+    std::atomic<uint64_t> eventStartPulses = {0}; // total count at the last resetWaterVolume
+    std::atomic<uint64_t> pulseOffset = {0};      // cumulative count restored at boot, the meter starts from zero
+
+    int numSamplesAnalogRead = 3; // analogRead fallback
+    unsigned int analogReadingTimeInterval = 100; // ms, analogRead fallback
+
+    int numSamplesAdcBurst = 256;
+    uint32_t muxSettleTime = 5; // ms after each multiplex switch
+    std::atomic<uint32_t> humiScanDuration = {0}; // ms, last humidity scan
+
+    AdcSampler adcSampler;
+
+    const bool asyncTempConversion = true; // false -> sequential blocking conversion per bus
+    std::atomic<uint32_t> tempSweepDuration = {0}; // ms, last temperature sweep
 
     OneWire oneWire[hardwareLimit];
     DallasTemperature tempSensors[hardwareLimit];
 
-    float tempValues[hardwareLimit] = {};
+    TempProbeTable probeTable = {};
+    float tempValues[maxTempProbes] = {};
     int humidityValues[hardwareLimit] = {};
+    AdcReading humidityReadings[hardwareLimit] = {};
 
     uint8_t multiplexBitLevel[8][3] = {
       {0, 0, 0}, // 0
@@ -44,17 +59,27 @@ class Peripheral
       {1, 1, 1}  // 7
     };
     
-    void readTempSensors(float tempArray[], int numSensors);
-
-    static void IRAM_ATTR fluxCounter();
+    void readTempSensors();
+    void readProbesOnBus(int bus);
   public:
     void initPeripheral();
     void analogReadAbsolute(int absoluteHumiArray[] , int numSensors);
     void humiCalibration(Sensor sensors[], int numSensors, bool op);
     void loadTempSensor(Sensor sensors[], int numSensors);
     void loadHumiSensor(Sensor sensors[], int numSensors);
+    uint32_t getTempSweepDuration();
+    void discoverTempProbes(TempProbeTable &table);
+    bool setTempProbes(TempProbeTable &table); // false if the stored table no longer matches the buses
+    int getNumTempProbes();
+    float getTempProbeValue(int probe);
+    AdcReading getHumiReading(int sensor); // average/median of the last scan
+    uint32_t getHumiScanDuration();
     
     double getWaterVolume();
+    uint64_t getTotalPulses(); // monotonic, never reset, carried across reboots by restorePulses
+    uint64_t getEventStartPulses();
+    void restorePulses(uint64_t totalPulses, uint64_t eventStart); // before anything samples the count
+    int getPulsesPerLiter();
     void powerValve(bool state);
     void resetWaterVolume();
 };
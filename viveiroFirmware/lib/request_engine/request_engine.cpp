@@ -0,0 +1,88 @@
+#include "request_engine.hpp"
+
+uint32_t RequestEngine::backoffDelay(uint8_t failures)
+{
+  uint32_t ceiling = baseBackoff;
+
+  for(int i = 1; i < failures && ceiling < maxBackoff; i++)
+  {
+    ceiling *= 2;
+  }
+  if(ceiling > maxBackoff) ceiling = maxBackoff;
+
+  return ceiling / 2 + esp_random() % (ceiling / 2 + 1); // equal jitter, devices that failed together spread out
+}
+
+bool RequestEngine::ready(ApiEndpoint endpoint, uint32_t now)
+{
+  EndpointRequest &request = endpoints[endpoint];
+
+  switch(request.state)
+  {
+    case REQUEST_BACKOFF:
+      if(now - request.failedAt < request.waitTime) return false;
+      request.state = REQUEST_IDLE;
+    break;
+
+    case REQUEST_OPEN:
+      if(now - request.failedAt < request.waitTime) return false;
+      request.state = REQUEST_HALF_OPEN;
+    break;
+
+    default:
+    break;
+  }
+  request.attempts++;
+  return true;
+}
+
+void RequestEngine::succeeded(ApiEndpoint endpoint)
+{
+  EndpointRequest &request = endpoints[endpoint];
+
+  request.state = REQUEST_IDLE;
+  request.failures = 0;
+}
+
+void RequestEngine::failed(ApiEndpoint endpoint, uint32_t now)
+{
+  EndpointRequest &request = endpoints[endpoint];
+
+  if(request.failures < 255) request.failures++;
+  request.failedAt = now;
+
+  if(request.state == REQUEST_HALF_OPEN || request.failures >= failuresToOpen)
+  {
+    if(request.state != REQUEST_OPEN) request.circuitTrips++;
+    request.state = REQUEST_OPEN;
+    request.waitTime = openCooldown / 2 + esp_random() % (openCooldown / 2 + 1);
+    return;
+  }
+  request.state = REQUEST_BACKOFF;
+  request.waitTime = backoffDelay(request.failures);
+}
+
+uint32_t RequestEngine::timeUntilReady(ApiEndpoint endpoint, uint32_t now)
+{
+  EndpointRequest &request = endpoints[endpoint];
+
+  if(request.state != REQUEST_BACKOFF && request.state != REQUEST_OPEN) return 0;
+
+  uint32_t elapsed = now - request.failedAt;
+  return elapsed >= request.waitTime ? 0 : request.waitTime - elapsed;
+}
+
+RequestState RequestEngine::getState(ApiEndpoint endpoint)
+{
+  return endpoints[endpoint].state;
+}
+
+uint32_t RequestEngine::getAttempts(ApiEndpoint endpoint)
+{
+  return endpoints[endpoint].attempts;
+}
+
+uint32_t RequestEngine::getCircuitTrips(ApiEndpoint endpoint)
+{
+  return endpoints[endpoint].circuitTrips;
+}
@@ -0,0 +1,48 @@
+#ifndef _REQUEST_ENGINE_HPP_
+#define _REQUEST_ENGINE_HPP_
+
+#include <Arduino.h>
+#include "data_types.hpp"
+
+typedef enum
+{
+  REQUEST_IDLE = 0,  // circuit closed, attempts allowed
+  REQUEST_BACKOFF,   // last attempt failed, waiting before the next one
+  REQUEST_OPEN,      // circuit open, endpoint considered down
+  REQUEST_HALF_OPEN  // cooldown over, one probe allowed
+}RequestState;
+
+typedef struct
+{
+  RequestState state;
+  uint8_t failures;  // consecutive
+  uint32_t failedAt; // ms
+  uint32_t waitTime; // ms after failedAt
+  uint32_t attempts;
+  uint32_t circuitTrips;
+}EndpointRequest;
+
+// per-endpoint retry state: exponential backoff with jitter and a circuit breaker
+class RequestEngine
+{
+  private:
+    static const uint32_t baseBackoff = 2000;    // ms
+    static const uint32_t maxBackoff = 120000;   // ms
+    static const uint8_t failuresToOpen = 5;
+    static const uint32_t openCooldown = 300000; // ms
+
+    EndpointRequest endpoints[ENDPOINT_COUNT] = {};
+
+    uint32_t backoffDelay(uint8_t failures);
+  public:
+    bool ready(ApiEndpoint endpoint, uint32_t now); // false while backing off or open, counts the attempt when true
+    void succeeded(ApiEndpoint endpoint);
+    void failed(ApiEndpoint endpoint, uint32_t now);
+
+    uint32_t timeUntilReady(ApiEndpoint endpoint, uint32_t now); // ms
+    RequestState getState(ApiEndpoint endpoint);
+    uint32_t getAttempts(ApiEndpoint endpoint);
+    uint32_t getCircuitTrips(ApiEndpoint endpoint);
+};
+
+#endif
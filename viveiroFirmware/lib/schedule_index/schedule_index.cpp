@@ -0,0 +1,87 @@
+#include "schedule_index.hpp"
+
+void ScheduleIndex::setRange(uint8_t map[], int from, int to)
+{
+  for(int minute = from; minute < to; minute++)
+  {
+    map[minute >> 3] |= 1 << (minute & 7);
+  }
+}
+
+void ScheduleIndex::addSlot(uint8_t map[], uint8_t nextDay[], int start, int end)
+{
+  setRange(map, start, end < minutesPerDay ? end : minutesPerDay);
+  if(end > minutesPerDay) setRange(nextDay, 0, end - minutesPerDay);
+}
+
+void ScheduleIndex::compile(TimeIrrigation schedules[], int numSlots)
+{
+  memset(everyDay, 0, sizeof(everyDay));
+  memset(weekDays, 0, sizeof(weekDays));
+  byWeekDay = false;
+
+  for(int i = 0; i < numSlots; i++)
+  {
+    if(schedules[i].enabled && (schedules[i].weekDays & allWeekDays) != allWeekDays) byWeekDay = true;
+  }
+
+  for(int i = 0; i < numSlots; i++)
+  {
+    TimeIrrigation &slot = schedules[i];
+    if(!slot.enabled) continue;
+
+    if(slot.initialTime.tm_hour < 0 || slot.initialTime.tm_hour > 23 || slot.initialTime.tm_min < 0 || slot.initialTime.tm_min > 59 ||
+       slot.finalTime.tm_hour < 0 || slot.finalTime.tm_hour > 24 || slot.finalTime.tm_min < 0 || slot.finalTime.tm_min > 59)
+    {
+      continue; // malformed, never opens the valve
+    }
+
+    int start = slot.initialTime.tm_hour * 60 + slot.initialTime.tm_min;
+    int end = slot.finalTime.tm_hour * 60 + slot.finalTime.tm_min;
+    if(end > minutesPerDay || end == start) continue; // equal times -> empty slot
+
+    if(end < start) end += minutesPerDay; // crosses midnight
+
+    if(!byWeekDay)
+    {
+      addSlot(everyDay, everyDay, start, end);
+      continue;
+    }
+    for(int day = 0; day < daysPerWeek; day++)
+    {
+      if(slot.weekDays & (1 << day)) addSlot(weekDays[day], weekDays[(day + 1) % daysPerWeek], start, end);
+    }
+  }
+}
+
+bool ScheduleIndex::isActive(int weekDay, int minuteOfDay)
+{
+  if(minuteOfDay < 0 || minuteOfDay >= minutesPerDay || weekDay < 0) return false;
+
+  const uint8_t *map = byWeekDay ? weekDays[weekDay % daysPerWeek] : everyDay;
+  return map[minuteOfDay >> 3] & (1 << (minuteOfDay & 7));
+}
+
+int ScheduleIndex::minutesUntilChange(int weekDay, int minuteOfDay)
+{
+  bool active = isActive(weekDay, minuteOfDay);
+  int horizon = byWeekDay ? daysPerWeek * minutesPerDay : minutesPerDay; // the pattern repeats after this
+
+  for(int ahead = 1; ahead <= horizon; ahead++)
+  {
+    int minute = minuteOfDay + ahead;
+    if(isActive((weekDay + minute / minutesPerDay) % daysPerWeek, minute % minutesPerDay) != active) return ahead;
+  }
+  return -1;
+}
+
+int ScheduleIndex::getActiveMinutes(int weekDay)
+{
+  int minutes = 0;
+
+  for(int minute = 0; minute < minutesPerDay; minute++)
+  {
+    if(isActive(weekDay, minute)) minutes++;
+  }
+  return minutes;
+}
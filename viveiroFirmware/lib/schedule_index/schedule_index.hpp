@@ -0,0 +1,29 @@
+#ifndef _SCHEDULE_INDEX_HPP_
+#define _SCHEDULE_INDEX_HPP_
+
+#include <Arduino.h>
+#include "data_types.hpp"
+
+// irrigation slots compiled into one bit per minute of the day
+// slots that run every day share one 180-byte map, a weekday restriction switches to one map per tm_wday
+class ScheduleIndex
+{
+  private:
+    static const int minutesPerDay = 1440;
+    static const int dayBytes = minutesPerDay / 8;
+    static const int daysPerWeek = 7;
+
+    uint8_t everyDay[dayBytes] = {};
+    uint8_t weekDays[daysPerWeek][dayBytes] = {};
+    bool byWeekDay = false; // some slot skips a day, decisions read weekDays
+
+    void setRange(uint8_t map[], int from, int to); // minutes [from, to)
+    void addSlot(uint8_t map[], uint8_t nextDay[], int start, int end); // end past midnight spills into nextDay
+  public:
+    void compile(TimeIrrigation schedules[], int numSlots); // caller holds the schedule lock
+    bool isActive(int weekDay, int minuteOfDay);
+    int minutesUntilChange(int weekDay, int minuteOfDay); // next on/off edge, -1 when the state never changes
+    int getActiveMinutes(int weekDay);
+};
+
+#endif
@@ -0,0 +1,221 @@
+#include "sensor_history.hpp"
+
+float SensorHistory::valueAt(uint32_t seq)
+{
+  return samples[seq % capacity].value;
+}
+
+void SensorHistory::updateQueue(uint32_t queue[], int &front, int &size, uint32_t seq, float value, uint32_t oldest, bool keepMin)
+{
+  while(size > 0 && queue[front] < oldest) // left the window
+  {
+    front = (front + 1) % capacity;
+    size--;
+  }
+
+  while(size > 0)
+  {
+    int back = (front + size - 1) % capacity;
+    float backValue = valueAt(queue[back]);
+    
+    if(keepMin ? backValue < value : backValue > value) break;
+    size--;
+  }
+
+  queue[(front + size) % capacity] = seq;
+  size++;
+}
+
+void SensorHistory::add(float value, uint32_t timestamp)
+{
+  if(isnan(value)) return;
+
+  if(count == capacity)
+  {
+    float evicted = samples[head].value;
+    sum -= evicted;
+    sumSquares -= (double)evicted * evicted;
+  }
+  else
+  {
+    count++;
+  }
+
+  uint32_t seq = sequence++;
+  uint32_t oldest = sequence - count;
+
+  samples[seq % capacity] = {timestamp, value};
+  head = sequence % capacity;
+  sum += value;
+  sumSquares += (double)value * value;
+
+  updateQueue(minQueue, minFront, minSize, seq, value, oldest, true);
+  updateQueue(maxQueue, maxFront, maxSize, seq, value, oldest, false);
+
+  emaValue = (seq == 0) ? value : emaValue + emaFactor * (value - emaValue);
+}
+
+void SensorHistory::clear()
+{
+  head = count = 0;
+  sequence = 0;
+  sum = sumSquares = 0;
+  minFront = minSize = maxFront = maxSize = 0;
+  emaValue = 0;
+}
+
+void SensorHistory::setFilter(SensorFilter filterType, float smoothing)
+{
+  filter = filterType;
+  emaFactor = smoothing;
+}
+
+int SensorHistory::size()
+{
+  return count;
+}
+
+SensorSample SensorHistory::latest()
+{
+  if(count == 0) return {0, NAN};
+  return samples[(sequence - 1) % capacity];
+}
+
+float SensorHistory::mean()
+{
+  if(count == 0) return NAN;
+  return sum / count;
+}
+
+float SensorHistory::minimum()
+{
+  if(minSize == 0) return NAN;
+  return valueAt(minQueue[minFront]);
+}
+
+float SensorHistory::maximum()
+{
+  if(maxSize == 0) return NAN;
+  return valueAt(maxQueue[maxFront]);
+}
+
+float SensorHistory::variance()
+{
+  if(count < 2) return 0;
+  double average = sum / count;
+  double result = (sumSquares - count * average * average) / (count - 1);
+  
+  return result > 0 ? result : 0; // rounding of the running sums
+}
+
+float SensorHistory::ema()
+{
+  if(count == 0) return NAN;
+  return emaValue;
+}
+
+float SensorHistory::median()
+{
+  float window[medianWindow];
+  int numValues = (count < medianWindow) ? count : medianWindow;
+
+  if(numValues == 0) return NAN;
+
+  for(int i = 0; i < numValues; i++) // insertion sort of the newest samples
+  {
+    float value = valueAt(sequence - 1 - i);
+    int j = i;
+    while(j > 0 && window[j-1] > value)
+    {
+      window[j] = window[j-1];
+      j--;
+    }
+    window[j] = value;
+  }
+  return window[numValues/2];
+}
+
+float SensorHistory::filtered()
+{
+  switch(filter)
+  {
+    case FILTER_MOVING_AVERAGE:
+      return mean();
+    case FILTER_MEDIAN:
+      return median();
+    case FILTER_EMA:
+      return ema();
+    default:
+      return latest().value;
+  }
+}
+
+
+void WindowAggregate::add(float value)
+{
+  if(isnan(value)) return;
+
+  if(numSamples == 0)
+  {
+    minValue = maxValue = value;
+  }
+  minValue = min(minValue, value);
+  maxValue = max(maxValue, value);
+
+  numSamples++;
+  double delta = value - meanValue;
+  meanValue += delta / numSamples;
+  m2 += delta * (value - meanValue);
+}
+
+void WindowAggregate::merge(WindowAggregate &other)
+{
+  if(other.numSamples == 0) return;
+  if(numSamples == 0)
+  {
+    *this = other;
+    return;
+  }
+
+  uint32_t total = numSamples + other.numSamples;
+  double delta = other.meanValue - meanValue;
+
+  meanValue += delta * other.numSamples / total;
+  m2 += other.m2 + delta * delta * ((double)numSamples * other.numSamples / total);
+  minValue = min(minValue, other.minValue);
+  maxValue = max(maxValue, other.maxValue);
+  numSamples = total;
+}
+
+void WindowAggregate::reset()
+{
+  numSamples = 0;
+  meanValue = m2 = 0;
+  minValue = maxValue = 0;
+}
+
+uint32_t WindowAggregate::count()
+{
+  return numSamples;
+}
+
+float WindowAggregate::minimum()
+{
+  return minValue;
+}
+
+float WindowAggregate::maximum()
+{
+  return maxValue;
+}
+
+float WindowAggregate::mean()
+{
+  return meanValue;
+}
+
+float WindowAggregate::stddev()
+{
+  if(numSamples < 2) return 0;
+  return sqrt(m2 / (numSamples - 1));
+}
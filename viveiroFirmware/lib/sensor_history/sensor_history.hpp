@@ -0,0 +1,85 @@
+#ifndef _SENSOR_HISTORY_HPP_
+#define _SENSOR_HISTORY_HPP_
+
+#include <Arduino.h>
+
+typedef struct
+{
+  uint32_t timestamp; // ms
+  float value;
+}SensorSample;
+
+typedef enum
+{
+  FILTER_NONE = 0,
+  FILTER_MOVING_AVERAGE,
+  FILTER_MEDIAN,
+  FILTER_EMA
+}SensorFilter;
+
+// fixed-capacity sample window per sensor channel, statistics updated in O(1) per sample
+class SensorHistory
+{
+  private:
+    static const int capacity = 18; // 180 s at one read every 10 s
+    static const int medianWindow = 5;
+
+    SensorSample samples[capacity] = {};
+    int head = 0;
+    int count = 0;
+    uint32_t sequence = 0; // samples added since start, identifies a slot in the deques
+
+    double sum = 0;
+    double sumSquares = 0;
+
+    // monotonic deques of sequence numbers, front holds the window min/max
+    uint32_t minQueue[capacity] = {};
+    uint32_t maxQueue[capacity] = {};
+    int minFront = 0, minSize = 0;
+    int maxFront = 0, maxSize = 0;
+
+    float emaValue = 0;
+    float emaFactor = 0.3;
+
+    SensorFilter filter = FILTER_MOVING_AVERAGE;
+
+    float valueAt(uint32_t seq);
+    void updateQueue(uint32_t queue[], int &front, int &size, uint32_t seq, float value, uint32_t oldest, bool keepMin);
+  public:
+    void add(float value, uint32_t timestamp);
+    void clear();
+    void setFilter(SensorFilter filterType, float smoothing = 0.3);
+
+    int size();
+    SensorSample latest();
+    float mean();
+    float minimum();
+    float maximum();
+    float variance();
+    float ema();
+    float median();
+    float filtered();
+};
+
+// count/min/max/mean/stddev of every sample between two uploads (Welford)
+class WindowAggregate
+{
+  private:
+    uint32_t numSamples = 0;
+    double meanValue = 0;
+    double m2 = 0;
+    float minValue = 0;
+    float maxValue = 0;
+  public:
+    void add(float value);
+    void merge(WindowAggregate &other); // combine two windows (Chan)
+    void reset();
+
+    uint32_t count();
+    float minimum();
+    float maximum();
+    float mean();
+    float stddev();
+};
+
+#endif
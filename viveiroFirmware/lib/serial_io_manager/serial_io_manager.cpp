@@ -319,6 +319,33 @@ bool SerialIOManager::readLinks(ApiLinks &apiLinks)
       if((currentMillis-LastActionMillis) > timeoutArgSerial) return false;
     }
 
+    clearSerialBuffer();
+    currentMillis = millis();
+    LastActionMillis = currentMillis;
+
+    serial->println(LINK_MQTT_TEXT);
+    
+    while(1)
+    {
+      if(serial->available()>0)
+      {
+        apiLinks.linkToMqttBroker = serial->readStringUntil('\n');
+        apiLinks.linkToMqttBroker.trim();
+        LastActionMillis = currentMillis;
+        serial->println(apiLinks.linkToMqttBroker);
+        break;
+      }
+      currentMillis = millis();
+      if((currentMillis-LastActionMillis) > timeoutArgSerial) return false;
+    }
+
+    clearSerialBuffer();
+    serial->println(FORMAT_SENSORS_TEXT);
+    apiLinks.sensorsFormat = (waitForInt(2, 0) == 2) ? PAYLOAD_CBOR : PAYLOAD_JSON;
+
+    serial->println(FORMAT_WATER_FLOW_TEXT);
+    apiLinks.waterFlowFormat = (waitForInt(2, 0) == 2) ? PAYLOAD_CBOR : PAYLOAD_JSON;
+
     showApiLinks(apiLinks);
 
     clearSerialBuffer();
@@ -428,6 +455,9 @@ void SerialIOManager::showApiLinks(ApiLinks &apiLinks)
   serial->println(apiLinks.linkToValveState);
   serial->println(apiLinks.linkToTimeValve);
   serial->println(apiLinks.linkToWaterFlow);
+  serial->println(apiLinks.linkToMqttBroker);
+  serial->println(apiLinks.sensorsFormat == PAYLOAD_CBOR ? "CBOR" : "JSON");
+  serial->println(apiLinks.waterFlowFormat == PAYLOAD_CBOR ? "CBOR" : "JSON");
 }
 
 
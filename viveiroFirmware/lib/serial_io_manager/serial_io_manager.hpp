@@ -30,6 +30,9 @@ const String LINK_SENSOR_READING_TEXT = "Link para envio das leituras dos sensor
 const String LINK_VALVE_TEXT = "Link para consulta do estado da válvula:";
 const String LINK_TIME_VALVE_TEXT = "Link para acessar o tempo de funcionamento da vávula:";
 const String LINK_WATER_FLOW_TEXT = "Link para envio das leitura do fluxo de água:";
+const String LINK_MQTT_TEXT = "Link do broker MQTT (mqtt://host:1883, linha vazia para desativar):";
+const String FORMAT_SENSORS_TEXT = "Formato do envio das leituras dos sensores: (1)JSON (2)CBOR";
+const String FORMAT_WATER_FLOW_TEXT = "Formato do envio do fluxo de água: (1)JSON (2)CBOR";
 const String LINK_CONFIRMATION_TEXT = "Deseja salvar os Links lidos? (0)Digitar novamente (1)Salvar (2)Sair";
 
 const String CLEAR_CONFIRMATION_TEXT = "Apagar todos os dados guardados? (0)Não (1)Sim";
@@ -0,0 +1,156 @@
+#include "time_service.hpp"
+
+TimeService *TimeService::instance = nullptr;
+
+void TimeService::begin(long gmtOffset, int daylightOffset)
+{
+  instance = this;
+
+  configTime(gmtOffset, daylightOffset, "time.nist.gov", "0.pool.ntp.org", "1.pool.ntp.org");
+  sntp_set_time_sync_notification_cb(onSync);
+  sntp_set_sync_interval(syncInterval);
+}
+
+void TimeService::onSync(struct timeval *tv)
+{
+  if(instance == nullptr || tv == nullptr) return;
+  instance->applySync((int64_t)tv->tv_sec * 1000000 + tv->tv_usec, esp_timer_get_time());
+}
+
+void TimeService::applySync(int64_t epoch, int64_t monotonic)
+{
+  portENTER_CRITICAL(&lock);
+  if(syncCount > 0)
+  {
+    int64_t elapsed = monotonic - syncMonotonic;
+    lastCorrection = (int32_t)((epoch - estimate(monotonic)) / 1000);
+
+    if(elapsed >= minDriftWindow)
+    {
+      // raw rate of esp_timer against sntp over this interval, smoothed 1/4
+      int32_t measured = (int32_t)(((elapsed - (epoch - syncEpoch)) * 1000000) / elapsed);
+      driftPpm = (syncCount == 1) ? measured : (driftPpm * 3 + measured) / 4;
+    }
+  }
+  syncEpoch = epoch;
+  syncMonotonic = monotonic;
+  syncCount++;
+
+  bool stable = syncCount > 1 && abs(lastCorrection) < stableCorrection;
+  if(stable) syncInterval = syncInterval * 2 > maxSyncInterval ? maxSyncInterval : syncInterval * 2;
+  else syncInterval = minSyncInterval;
+  uint32_t nextInterval = syncInterval;
+  TaskHandle_t listener = syncListener;
+  portEXIT_CRITICAL(&lock);
+
+  sntp_set_sync_interval(nextInterval); // picked up when lwip schedules the next request
+  if(listener != nullptr) xTaskNotifyGive(listener);
+}
+
+int64_t TimeService::estimate(int64_t monotonic)
+{
+  int64_t elapsed = monotonic - syncMonotonic;
+  return syncEpoch + elapsed - (elapsed * driftPpm) / 1000000;
+}
+
+bool TimeService::isSynced()
+{
+  return getSyncCount() > 0;
+}
+
+bool TimeService::now(time_t &epoch)
+{
+  uint32_t millisecond;
+  return now(epoch, millisecond);
+}
+
+bool TimeService::now(time_t &epoch, uint32_t &millisecond)
+{
+  int64_t monotonic = esp_timer_get_time();
+  int64_t estimated = 0;
+  bool synced;
+
+  portENTER_CRITICAL(&lock);
+  synced = syncCount > 0;
+  if(synced) estimated = estimate(monotonic);
+  portEXIT_CRITICAL(&lock);
+
+  if(!synced) return false;
+  epoch = (time_t)(estimated / 1000000);
+  millisecond = (uint32_t)((estimated % 1000000) / 1000);
+  return true;
+}
+
+void TimeService::notifyOnSync(TaskHandle_t task)
+{
+  portENTER_CRITICAL(&lock);
+  syncListener = task;
+  portEXIT_CRITICAL(&lock);
+}
+
+void TimeService::requestSync()
+{
+  if(sntp_enabled()) sntp_restart();
+}
+
+bool TimeService::localTime(struct tm &timeinfo)
+{
+  time_t epoch;
+
+  if(!now(epoch)) return false;
+  localtime_r(&epoch, &timeinfo);
+  return true;
+}
+
+TimeQuality TimeService::getQuality()
+{
+  if(!isSynced()) return TIME_UNSET;
+
+  uint32_t interval;
+  portENTER_CRITICAL(&lock);
+  interval = syncInterval;
+  portEXIT_CRITICAL(&lock);
+
+  return (uint64_t)getSyncAge() * 1000 > (uint64_t)interval * 2 ? TIME_HOLDOVER : TIME_SYNCED;
+}
+
+int32_t TimeService::getDriftPpm()
+{
+  int32_t drift;
+
+  portENTER_CRITICAL(&lock);
+  drift = driftPpm;
+  portEXIT_CRITICAL(&lock);
+  return drift;
+}
+
+int32_t TimeService::getLastCorrection()
+{
+  int32_t correction;
+
+  portENTER_CRITICAL(&lock);
+  correction = lastCorrection;
+  portEXIT_CRITICAL(&lock);
+  return correction;
+}
+
+uint32_t TimeService::getSyncAge()
+{
+  int64_t monotonic = esp_timer_get_time();
+  uint32_t age = 0;
+
+  portENTER_CRITICAL(&lock);
+  if(syncCount > 0) age = (uint32_t)((monotonic - syncMonotonic) / 1000000);
+  portEXIT_CRITICAL(&lock);
+  return age;
+}
+
+uint32_t TimeService::getSyncCount()
+{
+  uint32_t count;
+
+  portENTER_CRITICAL(&lock);
+  count = syncCount;
+  portEXIT_CRITICAL(&lock);
+  return count;
+}
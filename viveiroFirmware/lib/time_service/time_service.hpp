@@ -0,0 +1,55 @@
+#ifndef _TIME_SERVICE_HPP_
+#define _TIME_SERVICE_HPP_
+
+#include <Arduino.h>
+#include <time.h>
+#include "esp_timer.h"
+#include "esp_sntp.h"
+
+typedef enum
+{
+  TIME_UNSET = 0, // no sntp answer since boot
+  TIME_SYNCED,    // last answer within two sync intervals
+  TIME_HOLDOVER   // running on esp_timer and the measured drift
+}TimeQuality;
+
+// wall clock = last sntp time + esp_timer elapsed since, corrected by the measured drift
+// reads never block, sntp re-syncs on an interval that grows while the clock holds
+class TimeService
+{
+  private:
+    static const uint32_t minSyncInterval = 900000;    // ms
+    static const uint32_t maxSyncInterval = 14400000;  // ms
+    static const int32_t stableCorrection = 500;       // ms, below this the interval doubles
+    static const int64_t minDriftWindow = 60000000;    // us between syncs to measure drift
+
+    static TimeService *instance; // sntp callback has no argument
+
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    int64_t syncEpoch = 0;     // us, utc at the last sync
+    int64_t syncMonotonic = 0; // us, esp_timer at the last sync
+    int32_t driftPpm = 0;      // local timer fast > 0
+    int32_t lastCorrection = 0; // ms, sntp time - our estimate
+    uint32_t syncCount = 0;
+    uint32_t syncInterval = minSyncInterval;
+    TaskHandle_t syncListener = nullptr;
+
+    static void onSync(struct timeval *tv); // lwip tcpip task
+    void applySync(int64_t epoch, int64_t monotonic);
+    int64_t estimate(int64_t monotonic); // us, caller holds the lock
+  public:
+    void begin(long gmtOffset, int daylightOffset); // sets TZ and starts sntp, needs the network stack up
+    bool isSynced();
+    bool now(time_t &epoch);               // utc, false before the first sync
+    bool now(time_t &epoch, uint32_t &millisecond);
+    bool localTime(struct tm &timeinfo);   // TZ applied, false before the first sync
+    void notifyOnSync(TaskHandle_t task);  // task notification after every sntp correction
+    void requestSync();                    // sntp request now, not at the next interval
+    TimeQuality getQuality();
+    int32_t getDriftPpm();
+    int32_t getLastCorrection(); // ms
+    uint32_t getSyncAge();       // s, 0 before the first sync
+    uint32_t getSyncCount();
+};
+
+#endif
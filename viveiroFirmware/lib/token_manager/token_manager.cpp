@@ -0,0 +1,290 @@
+#include "token_manager.hpp"
+#include "json_writer.hpp"
+
+#include <ArduinoJson.h>
+
+bool TokenManager::begin(HardwareSerial &serialObj, Credentials &apiObj, String &link)
+{
+  serial = &serialObj;
+  apiAuth = &apiObj;
+  authenticateLink = &link;
+
+  if(refreshTask != nullptr) return true;
+
+  tokenMutex = xSemaphoreCreateMutex();
+  if(tokenMutex == nullptr) return false;
+
+  return xTaskCreatePinnedToCore(
+    taskRefresh,
+    "tokenTask",
+    taskStackSize,
+    this,
+    1,                      // Priority
+    &refreshTask,           // Handle
+    0                       // Core
+  ) == pdPASS;
+}
+
+void TokenManager::taskRefresh(void *pvParameters)
+{
+  ((TokenManager*)pvParameters)->refreshLoop();
+}
+
+void TokenManager::refreshLoop()
+{
+  for(;;)
+  {
+    uint32_t wait = timeUntilRefresh(millis());
+    if(wait == 0 && WiFi.status() != WL_CONNECTED) wait = offlineRetry;
+    if(wait == 0) wait = requestEngine.timeUntilReady(ENDPOINT_AUTHENTICATE, millis());
+
+    if(wait > 0)
+    {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait)); // invalidate() wakes the task early
+      continue;
+    }
+
+    if(requestEngine.ready(ENDPOINT_AUTHENTICATE, millis())) login();
+  }
+}
+
+uint32_t TokenManager::timeUntilRefresh(uint32_t now)
+{
+  uint32_t wait = 0;
+
+  xSemaphoreTake(tokenMutex, portMAX_DELAY);
+  if(!refreshRequested && generation != 0)
+  {
+    uint32_t elapsed = now - obtainedAt;
+    if(elapsed < refreshAfter) wait = refreshAfter - elapsed;
+  }
+  xSemaphoreGive(tokenMutex);
+  return wait;
+}
+
+bool TokenManager::login()
+{
+  JsonBufferWriter loginApi(loginBuffer, sizeof(loginBuffer));
+
+  loginApi.beginObject();
+  loginApi.key("username");
+  loginApi.value(apiAuth->login.c_str());
+  loginApi.key("password");
+  loginApi.value(apiAuth->password.c_str());
+  loginApi.endObject();
+
+  HTTPClient *http = connections.acquire(*authenticateLink);
+  if(http == nullptr)
+  {
+    requestEngine.failed(ENDPOINT_AUTHENTICATE, millis());
+    return false;
+  }
+
+  const char *headerKeys[] = {"Authorization"};
+  const size_t headerKeysCount = sizeof(headerKeys) / sizeof(headerKeys[0]);
+
+  http->addHeader("Content-Type", "application/json");
+  http->collectHeaders(headerKeys, headerKeysCount);
+
+  int responseCode = http->sendRequest("POST", (uint8_t*)loginApi.data(), loginApi.length());
+
+  String header;
+  if(responseCode == 200)
+  {
+    http->getString();
+    header = http->header("Authorization");
+  }
+  connections.drop(http); // next login is a refresh cycle away, the socket would be stale
+
+  if(responseCode != 200 || header.length() == 0 || header.length() >= maxTokenLength)
+  {
+    requestEngine.failed(ENDPOINT_AUTHENTICATE, millis()); // 4xx backs off too, repeated bad logins can lock the account
+    loginFailures++;
+    serial->print("apiToken_fail:"); // debug
+    serial->println(responseCode); // debug
+    return false;
+  }
+  requestEngine.succeeded(ENDPOINT_AUTHENTICATE);
+
+  uint32_t tokenLifetime;
+  if(!readLifetime(header.c_str(), tokenLifetime)) tokenLifetime = defaultLifetime;
+  if(tokenLifetime < minLifetime) tokenLifetime = minLifetime;
+
+  uint32_t margin = tokenLifetime / 4;
+  if(margin > refreshMargin) margin = refreshMargin;
+
+  xSemaphoreTake(tokenMutex, portMAX_DELAY);
+  strlcpy(token, header.c_str(), sizeof(token));
+  generation++;
+  obtainedAt = millis();
+  lifetime = tokenLifetime;
+  refreshAfter = tokenLifetime - margin;
+  refreshRequested = false;
+  refreshes++;
+  xSemaphoreGive(tokenMutex);
+
+  serial->print("apiTokenOK:"); // debug
+  serial->println(tokenLifetime / 1000); // debug
+  return true;
+}
+
+bool TokenManager::readLifetime(const char *jwt, uint32_t &lifetimeMs)
+{
+  // "Bearer header.payload.signature", only the payload claims are read
+  const char *payloadStart = strchr(jwt, '.');
+  if(payloadStart == nullptr) return false;
+  payloadStart++;
+
+  const char *payloadEnd = strchr(payloadStart, '.');
+  if(payloadEnd == nullptr) return false;
+
+  char claims[384];
+  size_t claimsLength = decodeBase64Url(payloadStart, payloadEnd - payloadStart, claims, sizeof(claims));
+  if(claimsLength == 0) return false;
+
+  StaticJsonDocument<32> filter;
+  filter["exp"] = true;
+  filter["iat"] = true;
+
+  StaticJsonDocument<64> doc;
+  if(deserializeJson(doc, claims, claimsLength, DeserializationOption::Filter(filter))) return false;
+
+  uint32_t expiry = doc["exp"] | 0UL;
+  uint32_t issuedAt = doc["iat"] | 0UL;
+  if(expiry == 0) return false;
+
+  time_t now = time(nullptr);
+  uint32_t seconds;
+  if(now > minValidEpoch) // clock set, exp counts from now
+  {
+    if(expiry <= now) return false;
+    seconds = expiry - now;
+  }
+  else if(issuedAt != 0 && expiry > issuedAt) // no clock yet, trust the issued lifetime
+  {
+    seconds = expiry - issuedAt;
+  }
+  else
+  {
+    return false;
+  }
+
+  lifetimeMs = seconds > 86400 ? 86400000 : seconds * 1000;
+  return true;
+}
+
+size_t TokenManager::decodeBase64Url(const char *input, size_t inputLength, char *output, size_t outputSize)
+{
+  uint32_t bits = 0;
+  int numBits = 0;
+  size_t length = 0;
+
+  for(size_t i = 0; i < inputLength; i++)
+  {
+    char c = input[i];
+    int value;
+
+    if(c >= 'A' && c <= 'Z') value = c - 'A';
+    else if(c >= 'a' && c <= 'z') value = c - 'a' + 26;
+    else if(c >= '0' && c <= '9') value = c - '0' + 52;
+    else if(c == '-' || c == '+') value = 62;
+    else if(c == '_' || c == '/') value = 63;
+    else if(c == '=') break;
+    else return 0;
+
+    bits = (bits << 6) | value;
+    numBits += 6;
+    if(numBits >= 8)
+    {
+      numBits -= 8;
+      if(length >= outputSize) return 0;
+      output[length++] = (char)((bits >> numBits) & 0xFF);
+    }
+  }
+  return length;
+}
+
+bool TokenManager::isValid()
+{
+  bool valid;
+
+  xSemaphoreTake(tokenMutex, portMAX_DELAY);
+  valid = generation != 0 && millis() - obtainedAt < lifetime;
+  xSemaphoreGive(tokenMutex);
+  return valid;
+}
+
+bool TokenManager::waitValid(uint32_t timeout)
+{
+  uint32_t initMillis = millis();
+
+  while(!isValid())
+  {
+    if(millis() - initMillis >= timeout) return false;
+    vTaskDelay(pdMS_TO_TICKS(renewalPoll));
+  }
+  return true;
+}
+
+uint32_t TokenManager::copyToken(char *output, size_t outputSize)
+{
+  uint32_t copied;
+
+  xSemaphoreTake(tokenMutex, portMAX_DELAY);
+  strlcpy(output, token, outputSize);
+  copied = generation;
+  xSemaphoreGive(tokenMutex);
+  return copied;
+}
+
+void TokenManager::invalidate(uint32_t rejectedGeneration)
+{
+  bool wake = false;
+
+  xSemaphoreTake(tokenMutex, portMAX_DELAY);
+  if(rejectedGeneration == generation && !refreshRequested) // a newer token or a pending login already covers it
+  {
+    refreshRequested = true;
+    wake = true;
+  }
+  xSemaphoreGive(tokenMutex);
+
+  if(wake) xTaskNotifyGive(refreshTask);
+}
+
+bool TokenManager::waitForRenewal(uint32_t rejectedGeneration, uint32_t timeout)
+{
+  uint32_t initMillis = millis();
+
+  while(millis() - initMillis < timeout)
+  {
+    xSemaphoreTake(tokenMutex, portMAX_DELAY);
+    bool renewed = generation != 0 && generation != rejectedGeneration;
+    xSemaphoreGive(tokenMutex);
+
+    if(renewed) return true;
+    vTaskDelay(pdMS_TO_TICKS(renewalPoll));
+  }
+  return false;
+}
+
+uint32_t TokenManager::getRefreshCount()
+{
+  return refreshes;
+}
+
+uint32_t TokenManager::getLoginFailures()
+{
+  return loginFailures;
+}
+
+uint32_t TokenManager::getTimeToExpiry()
+{
+  uint32_t remaining = 0;
+
+  xSemaphoreTake(tokenMutex, portMAX_DELAY);
+  uint32_t elapsed = millis() - obtainedAt;
+  if(generation != 0 && elapsed < lifetime) remaining = lifetime - elapsed;
+  xSemaphoreGive(tokenMutex);
+  return remaining;
+}
@@ -0,0 +1,61 @@
+#ifndef _TOKEN_MANAGER_HPP_
+#define _TOKEN_MANAGER_HPP_
+
+#include "HardwareSerial.h"
+#include "data_types.hpp"
+#include "connection_manager.hpp"
+#include "request_engine.hpp"
+
+#include <freertos/semphr.h>
+
+// api token owned by a background task: renewed before it expires, one login at a time
+class TokenManager
+{
+  private:
+    static const uint32_t defaultLifetime = 2700000;   // ms, token without a readable exp
+    static const uint32_t minLifetime = 60000;         // ms
+    static const uint32_t refreshMargin = 300000;      // ms before exp, capped to a quarter of the lifetime
+    static const uint32_t offlineRetry = 1000;         // ms, wifi down
+    static const uint32_t taskStackSize = 6144;        // tls handshake
+    static const time_t minValidEpoch = 1600000000;
+    static const size_t maxTokenLength = 1024;
+    static const uint32_t renewalPoll = 50;            // ms
+
+    HardwareSerial *serial;
+    Credentials *apiAuth;
+    String *authenticateLink;
+
+    ConnectionManager connections; // own socket, data requests never wait behind a login
+    RequestEngine requestEngine;
+    SemaphoreHandle_t tokenMutex = nullptr;
+    TaskHandle_t refreshTask = nullptr;
+
+    char token[maxTokenLength] = {};
+    char loginBuffer[256];
+    uint32_t generation = 0;      // +1 per login, 0 -> no token yet
+    uint32_t obtainedAt = 0;      // ms
+    uint32_t lifetime = 0;        // ms after obtainedAt
+    uint32_t refreshAfter = 0;    // ms after obtainedAt
+    bool refreshRequested = true;
+    uint32_t refreshes = 0;
+    uint32_t loginFailures = 0;
+
+    static void taskRefresh(void *pvParameters);
+    void refreshLoop();
+    uint32_t timeUntilRefresh(uint32_t now); // ms
+    bool login();
+    bool readLifetime(const char *jwt, uint32_t &lifetimeMs); // exp claim against the clock, or exp - iat
+    size_t decodeBase64Url(const char *input, size_t inputLength, char *output, size_t outputSize);
+  public:
+    bool begin(HardwareSerial &serialObj, Credentials &apiObj, String &link); // starts the refresh task, first login runs there
+    bool isValid();                                          // token present and not past its exp
+    bool waitValid(uint32_t timeout);                        // ms, radio just woke and the token lapsed while it was off
+    uint32_t copyToken(char *output, size_t outputSize);     // generation of the copied token, 0 -> none
+    void invalidate(uint32_t rejectedGeneration);            // server refused that token, callers sharing it cause one login
+    bool waitForRenewal(uint32_t rejectedGeneration, uint32_t timeout); // true once a newer token is in place
+    uint32_t getRefreshCount();
+    uint32_t getLoginFailures();
+    uint32_t getTimeToExpiry(); // ms, 0 -> expired or no token
+};
+
+#endif
@@ -0,0 +1,281 @@
+#include "wifi_manager.hpp"
+
+bool WifiManager::begin(Credentials &wifiObj)
+{
+  credentials = &wifiObj;
+
+  if(events == nullptr)
+  {
+    events = xEventGroupCreate();
+    if(events == nullptr) return false;
+
+    WiFi.onEvent([this](arduino_event_id_t event, arduino_event_info_t info) { onEvent(event, info); });
+  }
+
+  cacheValid = loadCache();
+
+  if(!radioOn)
+  {
+    periodStartedAt = millis();
+    radioOnSince = periodStartedAt;
+    radioOn = true;
+  }
+
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(false); // rejoins go through reconnectTask, with backoff and the cache
+  join();
+  enabled.store(true);
+
+  if(reconnectTask != nullptr) return true;
+
+  return xTaskCreatePinnedToCore(
+    taskReconnect,
+    "wifiTask",
+    taskStackSize,
+    this,
+    1,                      // Priority
+    &reconnectTask,         // Handle
+    0                       // Core
+  ) == pdPASS;
+}
+
+void WifiManager::onEvent(arduino_event_id_t event, arduino_event_info_t info)
+{
+  switch(event)
+  {
+    case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+    {
+      uint32_t latency = millis() - joinStartedAt.load();
+
+      joins++;
+      lastLatency.store(latency);
+      averageLatency.store(joins.load() == 1 ? latency : (averageLatency.load() * 7 + latency) / 8);
+      if(linkLost.exchange(false)) reconnects++;
+
+      xEventGroupSetBits(events, connectedBit);
+      cacheDirty.store(true); // nvs is written from reconnectTask
+      if(reconnectTask != nullptr) xTaskNotifyGive(reconnectTask);
+    }
+    break;
+
+    case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+    case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+      if(enabled.load() && (xEventGroupGetBits(events) & connectedBit)) // turnOff() is not a drop
+      {
+        disconnects++;
+        linkLost.store(true);
+      }
+      xEventGroupClearBits(events, connectedBit);
+      if(event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) lastDisconnectReason.store(info.wifi_sta_disconnected.reason);
+      if(reconnectTask != nullptr) xTaskNotifyGive(reconnectTask);
+    break;
+
+    default:
+    break;
+  }
+}
+
+void WifiManager::taskReconnect(void *pvParameters)
+{
+  ((WifiManager*)pvParameters)->reconnectLoop();
+}
+
+void WifiManager::reconnectLoop()
+{
+  uint32_t retryDelay = baseRetryDelay;
+
+  for(;;)
+  {
+    if(cacheDirty.exchange(false)) storeCache();
+
+    if(!enabled.load() || isConnected())
+    {
+      retryDelay = baseRetryDelay;
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY); // disconnect and got-ip events wake the task
+      continue;
+    }
+
+    if(!joinInFlight.load()) join(); // link dropped, begin() and turnOn() start their own join
+
+    bool joined = waitConnected(joiningFromCache ? fastJoinTimeout : joinTimeout);
+    joinInFlight.store(false);
+    if(joined || !enabled.load()) continue;
+
+    if(joiningFromCache) // bssid moved, next join scans
+    {
+      clearCache();
+      continue;
+    }
+
+    // failed joins post disconnect events too, only reconnectNow() cuts the backoff short
+    uint32_t waitStart = millis();
+    while(enabled.load() && !retryNow.exchange(false) && millis() - waitStart < retryDelay)
+    {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(retryDelay - (millis() - waitStart)));
+    }
+    retryDelay = retryDelay * 2 > maxRetryDelay ? maxRetryDelay : retryDelay * 2;
+  }
+}
+
+void WifiManager::join()
+{
+  joiningFromCache = cacheValid;
+  joinStartedAt.store(millis());
+  joinInFlight.store(true);
+
+  WiFi.disconnect(false);
+  WiFi.config(IPAddress(), IPAddress(), IPAddress()); // dhcp, a reused lease could outlive its expiry
+  if(joiningFromCache)
+  {
+    WiFi.begin(credentials->login.c_str(), credentials->password.c_str(), cache.channel, cache.bssid);
+  }
+  else
+  {
+    WiFi.begin(credentials->login.c_str(), credentials->password.c_str());
+  }
+}
+
+bool WifiManager::loadCache()
+{
+  if(!nvs.begin(cacheNamespace, true)) return false; // true -> read only
+
+  size_t length = nvs.getBytes(keyCache, &cache, sizeof(cache));
+  nvs.end();
+
+  if(length != sizeof(cache) || cache.version != cacheVersion) return false;
+  cache.ssid[sizeof(cache.ssid) - 1] = '\0';
+  return credentials->login == cache.ssid && cache.channel != 0;
+}
+
+void WifiManager::storeCache()
+{
+  WifiCache current = {};
+
+  current.version = cacheVersion;
+  current.channel = WiFi.channel();
+  memcpy(current.bssid, WiFi.BSSID(), sizeof(current.bssid));
+  strlcpy(current.ssid, credentials->login.c_str(), sizeof(current.ssid));
+
+  if(cacheValid && memcmp(&current, &cache, sizeof(current)) == 0) return;
+
+  cache = current;
+  cacheValid = cache.channel != 0;
+
+  if(!nvs.begin(cacheNamespace, false)) return; // false -> write and read
+  nvs.putBytes(keyCache, &cache, sizeof(cache));
+  nvs.end();
+}
+
+void WifiManager::clearCache()
+{
+  cacheValid = false;
+  cache = {};
+
+  if(!nvs.begin(cacheNamespace, false)) return;
+  nvs.clear();
+  nvs.end();
+}
+
+bool WifiManager::isConnected()
+{
+  return events != nullptr && (xEventGroupGetBits(events) & connectedBit);
+}
+
+bool WifiManager::waitConnected(uint32_t timeout)
+{
+  if(events == nullptr) return false;
+  return xEventGroupWaitBits(events, connectedBit, pdFALSE, pdTRUE, pdMS_TO_TICKS(timeout)) & connectedBit;
+}
+
+void WifiManager::reconnectNow()
+{
+  if(reconnectTask == nullptr || isConnected()) return;
+  retryNow.store(true);
+  xTaskNotifyGive(reconnectTask);
+}
+
+void WifiManager::turnOff()
+{
+  enabled.store(false);
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+
+  uint32_t now = millis();
+  accountRadioTime(now);
+  if(radioOn) onTimeThisPeriod += now - radioOnSince;
+  radioOn = false;
+}
+
+void WifiManager::turnOn()
+{
+  if(enabled.load()) return;
+
+  uint32_t now = millis();
+  accountRadioTime(now);
+  radioOnSince = now;
+  radioOn = true;
+
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(false);
+  join();
+  enabled.store(true);
+  if(reconnectTask != nullptr) xTaskNotifyGive(reconnectTask);
+}
+
+bool WifiManager::isRadioOn()
+{
+  return radioOn;
+}
+
+void WifiManager::setModemSleep(bool maxModem)
+{
+  WiFi.setSleep(maxModem ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+}
+
+void WifiManager::accountRadioTime(uint32_t now)
+{
+  while(now - periodStartedAt >= radioReportPeriod)
+  {
+    uint32_t periodEnd = periodStartedAt + radioReportPeriod;
+
+    if(radioOn) // split the on interval at the period boundary
+    {
+      onTimeThisPeriod += periodEnd - radioOnSince;
+      radioOnSince = periodEnd;
+    }
+    onTimeLastPeriod = onTimeThisPeriod;
+    onTimeThisPeriod = 0;
+    periodStartedAt = periodEnd;
+  }
+}
+
+uint32_t WifiManager::getDisconnectCount()
+{
+  return disconnects.load();
+}
+
+uint32_t WifiManager::getReconnectCount()
+{
+  return reconnects.load();
+}
+
+uint32_t WifiManager::getLastLatency()
+{
+  return lastLatency.load();
+}
+
+uint32_t WifiManager::getAverageLatency()
+{
+  return averageLatency.load();
+}
+
+uint8_t WifiManager::getLastDisconnectReason()
+{
+  return lastDisconnectReason.load();
+}
+
+uint32_t WifiManager::getRadioOnTime()
+{
+  accountRadioTime(millis());
+  return onTimeLastPeriod;
+}
@@ -0,0 +1,90 @@
+#ifndef _WIFI_MANAGER_HPP_
+#define _WIFI_MANAGER_HPP_
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <Preferences.h>
+#include <atomic>
+#include <freertos/event_groups.h>
+#include "data_types.hpp"
+
+typedef struct
+{
+  uint8_t version;
+  uint8_t channel;
+  uint8_t bssid[6];
+  char ssid[33];      // cache belongs to these credentials
+}WifiCache;
+
+// station connection driven by WiFi.onEvent, rejoins in the background
+// the last good bssid/channel is kept in the "wifiCache" nvs namespace so joins skip the scan, the address always comes from dhcp
+class WifiManager
+{
+  private:
+    static const EventBits_t connectedBit = BIT0;
+    static const uint8_t cacheVersion = 2;             // 2 -> no cached lease
+    static const uint32_t joinTimeout = 10000;         // ms, full scan + dhcp
+    static const uint32_t fastJoinTimeout = 5000;      // ms, known channel, dhcp
+    static const uint32_t baseRetryDelay = 1000;       // ms
+    static const uint32_t maxRetryDelay = 60000;       // ms
+    static const uint32_t taskStackSize = 4096;
+    static const uint32_t radioReportPeriod = 3600000; // ms
+
+    Credentials *credentials;
+    Preferences nvs;
+    char cacheNamespace[10] = "wifiCache";
+    char keyCache[6] = "cache";
+
+    EventGroupHandle_t events = nullptr;
+    TaskHandle_t reconnectTask = nullptr;
+    WifiCache cache = {};
+    bool cacheValid = false;
+    bool joiningFromCache = false;
+
+    std::atomic<bool> enabled = {0};
+    std::atomic<bool> cacheDirty = {0};
+    std::atomic<bool> retryNow = {0};
+    std::atomic<bool> joinInFlight = {0};
+    std::atomic<bool> linkLost = {0};          // dropped while enabled, next got-ip is a reconnect
+    std::atomic<uint32_t> joinStartedAt = {0};
+    std::atomic<uint32_t> joins = {0};
+    std::atomic<uint32_t> disconnects = {0};
+    std::atomic<uint32_t> reconnects = {0};
+    std::atomic<uint32_t> lastLatency = {0};    // ms, join start -> got ip
+    std::atomic<uint32_t> averageLatency = {0}; // ms, ema 1/8
+    std::atomic<uint8_t> lastDisconnectReason = {0};
+
+    // radio-on accounting, turnOn/turnOff/getRadioOnTime from the same task
+    bool radioOn = false;
+    uint32_t radioOnSince = 0;   // ms
+    uint32_t periodStartedAt = 0; // ms
+    uint32_t onTimeThisPeriod = 0;
+    uint32_t onTimeLastPeriod = 0;
+
+    void onEvent(arduino_event_id_t event, arduino_event_info_t info); // arduino event task
+    static void taskReconnect(void *pvParameters);
+    void reconnectLoop();
+    void join();
+    bool loadCache();
+    void storeCache();
+    void clearCache();
+    void accountRadioTime(uint32_t now); // closes the report periods that ended before now
+  public:
+    bool begin(Credentials &wifiObj); // starts the first join and the reconnect task
+    bool isConnected();
+    bool waitConnected(uint32_t timeout); // ms, blocks on the event bit
+    void reconnectNow();                  // skip the remaining backoff
+    void turnOff();                       // radio off, no rejoin until turnOn
+    void turnOn();
+    bool isRadioOn();
+    void setModemSleep(bool maxModem); // false -> core default (min modem)
+
+    uint32_t getDisconnectCount();
+    uint32_t getReconnectCount(); // recoveries after a drop, planned turnOn joins excluded
+    uint32_t getLastLatency();
+    uint32_t getAverageLatency();
+    uint8_t getLastDisconnectReason();
+    uint32_t getRadioOnTime(); // ms of radio on during the last full hour
+};
+
+#endif
@@ -24,6 +24,14 @@
 #include "data_types.hpp"
 #include "api_comm.hpp"
 #include "peripheral_control.hpp"
+#include "flow_analytics.hpp"
+#include "sensor_history.hpp"
+#include "deadband_filter.hpp"
+#include "offline_queue.hpp"
+#include "mqtt_transport.hpp"
+#include "time_service.hpp"
+#include "flow_totalizer.hpp"
+#include "schedule_index.hpp"
 
 const esp_task_wdt_config_t configWDTtask = {30000,true};
 
@@ -38,37 +46,68 @@ TimerHandle_t irrigationScheduleUpdateTimer = nullptr;
 TimerHandle_t sensorDataSendingTimer = nullptr;
 //TimerHandle_t resetTimer = nullptr;
 TimerHandle_t apiValveTimer = nullptr;
+TimerHandle_t flowSampleTimer = nullptr;
+
+TaskHandle_t valveTaskHandle = nullptr; // notified when the schedule or the clock changes
 
 std::atomic<bool> flagScheduleCheck = {0};
 std::atomic<bool> flagSendSensors = {0};
 std::atomic<bool> flagSendFlow = {0};
+std::atomic<int> pendingFlowEvent = {FLOW_EVENT_NONE}; // set last, flowEventRate/flowEventTime are ready when it is seen
+std::atomic<float> flowEventRate = {0}; // L/min at detection
+std::atomic<uint32_t> flowEventTime = {0}; // epoch s, 0 -> no clock
 std::atomic<bool> flagRestartPermission = {0};
 std::atomic<bool> flagCheckValveStatusApi = {0};
 std::atomic<bool> valveActivated = {0};
-std::atomic<bool> hourUnavailable = {1};
 
 const uint32_t systemCheckTime = 5000;
 
 //all times in ms
 const uint32_t timeBetweenSensorReads = 10000;
-const uint32_t valveStateCheckInterval = 10000;
-const uint32_t delayTaskCommunication = 10000;
+const uint32_t valveStateCheckInterval = 10000; // until the first sntp sync
+const uint32_t valveClockCheck = 1800; // s, wakes on every utc half hour to follow local-time (dst) jumps
+const uint32_t apiTaskTick = 1000; // requests are single attempts, retries wait in the request engine
+
+const long gmtOffset = -4 * 3600; // s
+const int daylightOffset = 3600;  // s
 
 const uint32_t timeSendSensorReadingsApi = 180000;
 const uint32_t timeToCheckAPiIrrigationSchedules = 3600000;
 const uint32_t timeCheckValveStatusApi = 60000;
+const uint32_t flowSampleInterval = 1000;
+
+const int maxQueueDrainRecords = 20; // per apiTask cycle, keeps valve polling responsive
 const uint32_t minSystemRestartTime = 21600000;
 
-struct tm currentTime;
+const SensorUploadMode sensorUploadMode = UPLOAD_AGGREGATE;
+const bool deadbandUpload = false; // post only the channels that changed since the last upload
+
+const RadioPowerMode radioPowerMode = RADIO_ALWAYS_ON; // battery/solar sites: RADIO_DUTY_CYCLED
+const uint32_t radioWakeTimeout = 10000; // join + token, ms
+const uint32_t radioReportInterval = 3600000;
+
+const float humiDeadbandAbsolute = 2.0; // %
+const float tempDeadbandAbsolute = 0.5; // °C
+const float deadbandRelative = 0.05;
+const uint32_t maxSensorSilence = 1800000; // heartbeat, ms
 
 Peripheral sensorsDevices;
 SerialIOManager serialIOManager(&Serial, &sensorsDevices);
 DataManager dataManager;
 ApiComm apiClient;
+FlowAnalytics flowAnalytics;
+OfflineQueue offlineQueue;
+MqttTransport mqttTransport;
+TimeService timeService;
+FlowTotalizer flowTotalizer;
+ScheduleIndex scheduleIndex; // compiled from irrigationSchedulesNvs, guarded by xMutexIrrigationData
 
 Credentials wifiCredentials = {}, apiCredentials = {};
 ApiLinks apiLinks = {};
 Sensor humiSensors[numModules] = {{}}, tempSensors[numModules] = {{}};
+SensorHistory humiHistory[numModules], tempHistory[numModules];
+WindowAggregate humiAggregate[numModules], tempAggregate[numModules];
+DeadbandFilter humiDeadband[numModules], tempDeadband[numModules];
 TimeIrrigation irrigationSchedulesNvs[maxIrrigationSlots] = {{}};
 TimeIrrigation irrigationSchedulesApi[maxIrrigationSlots] = {{}};
 
@@ -92,8 +131,27 @@ void timerCallbackReset(TimerHandle_t xTimer);
 
 void timerCallbackValveState(TimerHandle_t xTimer);
 
+void timerCallbackFlowSample(TimerHandle_t xTimer);
+
 bool checkValveStatusIrrigationSchedules(); 
 
+bool nextValveState(bool &valveState, uint32_t &waitMs); // false without a clock
+
+void compileSchedules(); // caller holds xMutexIrrigationData
+
+void loadTempProbes();
+
+void filterSensorReadings(Sensor sensors[], SensorHistory history[], WindowAggregate aggregate[], int numSensors, uint32_t timestamp);
+
+bool sendSensorsData(); // copies the readings under xMutexSensorData, posts without holding it
+void mergeBackWindows(WindowAggregate humiWindow[], WindowAggregate tempWindow[], const bool sentHumi[], const bool sentTemp[]); // unsent windows ride on the next upload, nullptr -> none was sent
+
+int selectChangedSensors(Sensor sensors[], DeadbandFilter deadband[], bool include[], int numSensors, uint32_t now);
+
+void markSensorsSent(Sensor sensors[], DeadbandFilter deadband[], bool include[], int numSensors, uint32_t now);
+
+bool radioWindowDue(bool inconsistentSchedules); // duty-cycled radio: only valve polls, flow reports and events, schedule repairs and clock syncs wake it
+
 void setup()
 {
   serialIOManager.begin(115200);
@@ -102,6 +160,26 @@ void setup()
   if(serialIOManager.waitforPowerMode()) settings(); //use pin configuration in production
 
   if(!dataManager.loadAllData(humiSensors, tempSensors, wifiCredentials, apiCredentials, apiLinks, irrigationSchedulesNvs)) Serial.println("nvs_fail");
+  scheduleIndex.compile(irrigationSchedulesNvs, maxIrrigationSlots); // tasks not started yet
+
+  loadTempProbes();
+
+  if(!flowTotalizer.begin(sensorsDevices, dataManager, sensorsDevices.getPulsesPerLiter())) Serial.println("flowTotal_new"); // before anything samples the meter
+  Serial.print("flowTotal:"); // debug
+  Serial.println(static_cast<double>(flowTotalizer.getTotalPulses()) / sensorsDevices.getPulsesPerLiter()); // debug
+
+  dataManager.flushWriteStats(); // setup and migration writes, the runtime ones go hourly
+  NvsWriteStats nvsWrites;
+  if(dataManager.loadTotalWriteStats(nvsWrites)) // flash wear since the last erase
+  {
+    Serial.print("nvsWrites:"); // debug
+    Serial.println(nvsWrites.entries); // debug
+    Serial.print("nvsWrittenBytes:"); // debug
+    Serial.println(nvsWrites.bytes); // debug
+  }
+
+  if(!offlineQueue.begin()) Serial.println("uploadQueue_fail");
+  apiClient.attachOfflineQueue(&offlineQueue);
 
   xMutexIrrigationData = xSemaphoreCreateMutex();
   xMutexSensorData = xSemaphoreCreateMutex();
@@ -111,11 +189,21 @@ void setup()
   sensorDataSendingTimer = xTimerCreate("sensorSending", pdMS_TO_TICKS(timeSendSensorReadingsApi), pdTRUE, (void *) 2, timerCallbacksensorSending);
   //resetTimer = xTimerCreate("espRestart", minSystemRestartTime, pdFALSE, (void*) 3, timerCallbackReset);
   apiValveTimer = xTimerCreate("valveCheck", pdMS_TO_TICKS(timeCheckValveStatusApi), pdTRUE,(void*) 4, timerCallbackValveState);
+  flowSampleTimer = xTimerCreate("flowSample", pdMS_TO_TICKS(flowSampleInterval), pdTRUE, (void*) 5, timerCallbackFlowSample);
+
+  flowAnalytics.begin(sensorsDevices.getPulsesPerLiter());
+
+  for(int i = 0; i < numModules; i++)
+  {
+    humiDeadband[i].configure(humiDeadbandAbsolute, deadbandRelative, maxSensorSilence);
+    tempDeadband[i].configure(tempDeadbandAbsolute, deadbandRelative, maxSensorSilence);
+  }
 
   xTimerStart(irrigationScheduleUpdateTimer, 0);
   xTimerStart(sensorDataSendingTimer, 0);
   //xTimerStart(resetTimer, 0);
   xTimerStart(apiValveTimer,0);
+  xTimerStart(flowSampleTimer, 0);
 
   rtc_wdt_protect_off();      //Disable RTC WDT write protection
   rtc_wdt_disable(); 
@@ -139,7 +227,7 @@ void setup()
     4096,                      
     NULL,                      
     1,                         // Priority
-    NULL,                      // Handle
+    &valveTaskHandle,          // Handle
     1                          // Core
   );
   xTaskCreatePinnedToCore(
@@ -169,8 +257,7 @@ void loop()
 
 void taskReadSensors(void *pvParameters) {
   const TickType_t delayBetweenSensorReads = pdMS_TO_TICKS(timeBetweenSensorReads);
-  //usando uma task só pra isso com a possibilidade de fazer uma média móvel/gaussiana ou algo do tipo,
-  //caso não, as funções de leitura podem ser chamadas na task api antes do momento de envio
+  //leituras filtradas por média móvel (SensorHistory), o valor enviado para a api é o filtrado
   for(;;) 
   {
     if (xSemaphoreTake(xMutexSensorData, portMAX_DELAY)) 
@@ -180,6 +267,15 @@ void taskReadSensors(void *pvParameters) {
       sensorsDevices.loadTempSensor(tempSensors, numModules); 
       sensorsDevices.loadHumiSensor(humiSensors, numModules); 
 
+      uint32_t readTimestamp = millis();
+      filterSensorReadings(tempSensors, tempHistory, tempAggregate, numModules, readTimestamp);
+      filterSensorReadings(humiSensors, humiHistory, humiAggregate, numModules, readTimestamp);
+
+      Serial.print("tempSweep:"); // debug
+      Serial.println(sensorsDevices.getTempSweepDuration()); // debug
+      Serial.print("humiScan:"); // debug
+      Serial.println(sensorsDevices.getHumiScanDuration()); // debug
+
       xSemaphoreGive(xMutexSensorData);
     }
     vTaskDelay(delayBetweenSensorReads);
@@ -187,53 +283,76 @@ void taskReadSensors(void *pvParameters) {
 }
 
 void taskValve(void *pvParameters) {
-  const TickType_t stateDelay = pdMS_TO_TICKS(valveStateCheckInterval);
+  const TickType_t unsyncedDelay = pdMS_TO_TICKS(valveStateCheckInterval);
   bool valveState = false;
   bool lastValveState = false;
-  int apiResponse = -1;
-  bool timeOK = false;
 
+  timeService.notifyOnSync(xTaskGetCurrentTaskHandle()); // corrections move the next edge
 
+  // edge-triggered: sleeps until the next schedule transition, schedule updates and sntp syncs wake it early
   for(;;)
   {
-    if(!timeOK)
+    uint32_t waitMs;
+
+    if(!nextValveState(valveState, waitMs)) // schedules are wall-clock times
     {
-      if(hourUnavailable.load()) timeOK = true;
+      ulTaskNotifyTake(pdTRUE, unsyncedDelay);
+      continue;
     }
 
-    if(timeOK)
+    if(valveState != lastValveState)
     {
-      if(xSemaphoreTake(xMutexIrrigationData, portMAX_DELAY))
-      {
-        valveState = checkValveStatusIrrigationSchedules();
-        xSemaphoreGive(xMutexIrrigationData);
-        if(valveState) 
-        { 
-          Serial.println("schTurnON");
-        }
-        else
-        {
-          Serial.println("schTurnOFF");
-        }
-      }   
+      sensorsDevices.powerValve(valveState);
+      valveActivated.store(valveState);
+      flowAnalytics.setValveState(valveState);
+      Serial.println(valveState ? "schTurnON" : "schTurnOFF");
 
       if(valveState == false && lastValveState == true)
       {
         flagSendFlow.store(true);  
       }
-
       lastValveState = valveState;
-      
-      valveActivated.store(valveState);
-      sensorsDevices.powerValve(valveState);
     }
-    vTaskDelay(stateDelay);
+
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
+  }
+}
+
+bool nextValveState(bool &valveState, uint32_t &waitMs)
+{
+  time_t epoch;
+  uint32_t millisecond;
+  struct tm currentTime;
+
+  if(!timeService.now(epoch, millisecond)) return false;
+  localtime_r(&epoch, &currentTime);
+
+  int minuteOfDay = currentTime.tm_hour * 60 + currentTime.tm_min;
+  int minutesToEdge = -1;
+
+  if(xSemaphoreTake(xMutexIrrigationData, portMAX_DELAY))
+  {
+    valveState = scheduleIndex.isActive(currentTime.tm_wday, minuteOfDay);
+    minutesToEdge = scheduleIndex.minutesUntilChange(currentTime.tm_wday, minuteOfDay);
+    xSemaphoreGive(xMutexIrrigationData);
+  }
+
+  uint32_t intoMinute = currentTime.tm_sec * 1000 + millisecond;
+  waitMs = (valveClockCheck - epoch % valveClockCheck) * 1000 - millisecond;
+  if(minutesToEdge > 0 && (uint32_t)minutesToEdge * 60000 - intoMinute < waitMs)
+  {
+    waitMs = (uint32_t)minutesToEdge * 60000 - intoMinute;
   }
+  if(waitMs == 0) waitMs = 1;
+
+  Serial.print("valveNextCheck:"); // debug
+  Serial.println(waitMs / 1000); // debug
+  return true;
 }
 
 void taskApiCommunication(void *pvParameters)
 {
-  const TickType_t referenceDelay = pdMS_TO_TICKS(delayTaskCommunication);
+  const TickType_t tickDelay = pdMS_TO_TICKS(apiTaskTick);
   Serial.println(esp_task_wdt_reconfigure(&configWDTtask));
   bool firstExecution = true;
   bool inconsistentIrrigationSchedules = false;
@@ -249,34 +368,76 @@ void taskApiCommunication(void *pvParameters)
   {
     Serial.println("initApi_Fail");
   }
-  hourUnavailable.store(!getLocalTime(&currentTime, 5000));
 
-  sensorsDevices.loadTempSensor(tempSensors, numModules);
-  sensorsDevices.loadHumiSensor(humiSensors, numModules);
-  
+  if(mqttTransport.begin(apiLinks.linkToMqttBroker, xTaskGetCurrentTaskHandle())) // valve/schedule pushes wake this task
+  {
+    apiClient.attachMqtt(&mqttTransport);
+    Serial.println("initMqtt_OK");
+  }
+  timeService.begin(gmtOffset, daylightOffset); // sntp keeps its own schedule from here
+
+  Sensor humiFirst[numModules], tempFirst[numModules];
+  if(xSemaphoreTake(xMutexSensorData, portMAX_DELAY)) // adc/onewire buses shared with sensorsTask
+  {
+    sensorsDevices.loadTempSensor(tempSensors, numModules);
+    sensorsDevices.loadHumiSensor(humiSensors, numModules);
+    memcpy(humiFirst, humiSensors, sizeof(humiFirst));
+    memcpy(tempFirst, tempSensors, sizeof(tempFirst));
+    xSemaphoreGive(xMutexSensorData);
+  }
   Serial.println("senAllSensorsData_first");
-  apiClient.sendAllSensorsData(humiSensors, tempSensors, numModules, numModules);
+  apiClient.sendAllSensorsData(humiFirst, tempFirst, numModules, numModules);
 
-  if(apiClient.searchForIrrigationTime(irrigationSchedulesApi))
+  bool schedulesChanged;
+  if(apiClient.searchForIrrigationTime(irrigationSchedulesApi, schedulesChanged) && schedulesChanged && xSemaphoreTake(xMutexIrrigationData, portMAX_DELAY))
   {
-    dataManager.compareAndStoreIrrigationSchedulesData(irrigationSchedulesNvs, irrigationSchedulesApi);
+    if(dataManager.compareAndStoreIrrigationSchedulesData(irrigationSchedulesNvs, irrigationSchedulesApi)) compileSchedules();
+    xSemaphoreGive(xMutexIrrigationData);
   }
 
+  if(radioPowerMode == RADIO_MODEM_SLEEP) apiClient.setModemSleep(true);
+  if(radioPowerMode == RADIO_DUTY_CYCLED && timeService.getQuality() == TIME_SYNCED) apiClient.turnOffWifi(); // no clock yet, stays on for sntp
+  uint32_t lastRadioReport = millis();
+
   for(;;)
   {
-    if(xSemaphoreTake(xMutexCriticalApiSend,portMAX_DELAY))
+    flowTotalizer.checkpoint(millis()); // apiTask owns dataManager at runtime
+
+    if(millis() - lastRadioReport >= radioReportInterval)
+    {
+      lastRadioReport = millis();
+      dataManager.flushWriteStats(); // write counters stay in ram between reports
+      Serial.print("radioOnTime:"); // debug
+      Serial.println(apiClient.getRadioOnTime() / 1000); // debug
+    }
+
+    if(radioPowerMode == RADIO_DUTY_CYCLED && !apiClient.isRadioOn())
     {
-      if(flagCheckValveStatusApi.load())
+      if(!radioWindowDue(inconsistentIrrigationSchedules))
       {
+        ulTaskNotifyTake(pdTRUE, tickDelay); // sensors, schedule checks and the queue wait for the next window
+        continue;
+      }
+      Serial.println("radioWake");
+      if(!apiClient.wakeRadio(radioWakeTimeout)) Serial.println("radioWake_fail"); // the window still runs, uploads queue
+      if(timeService.getQuality() != TIME_SYNCED) timeService.requestSync(); // lwip would wait for its next interval
+    }
 
-        if(hourUnavailable.load())
-        {
-          Serial.println("hourUnavailable_newAttempt");
-          apiClient.loadWebTime();
-          vTaskDelay(referenceDelay);
-          hourUnavailable.store(!getLocalTime(&currentTime, 5000));
-        }
+    if(xSemaphoreTake(xMutexCriticalApiSend,portMAX_DELAY))
+    {
+      bool valveStateReceived = false;
 
+      if(mqttTransport.takeValveState(valveStateApi)) // pushed command
+      {
+        valveStateReceived = true;
+        Serial.println("mqttValveState");
+      }
+      else if(flagCheckValveStatusApi.load() && mqttTransport.isConnected()) // http poll is the fallback
+      {
+        flagCheckValveStatusApi.store(false);
+      }
+      else if(flagCheckValveStatusApi.load() && apiClient.isEndpointReady(ENDPOINT_VALVE_STATE)) // stays pending while backing off
+      {
         flagCheckValveStatusApi.store(false);
 
         apiClient.checkAndReconnectWiFi();
@@ -292,7 +453,11 @@ void taskApiCommunication(void *pvParameters)
         {
           Serial.println("apiValveState");
         }
+        valveStateReceived = true;
+      }
 
+      if(valveStateReceived)
+      {
         if(valveStateApi >= 0)
         {
           bool schedulesStatus;
@@ -316,64 +481,92 @@ void taskApiCommunication(void *pvParameters)
         firstExecution = false;
       }
       
+      int flowEvent = pendingFlowEvent.exchange(FLOW_EVENT_NONE);
+      if(flowEvent != FLOW_EVENT_NONE)
+      {
+        Serial.println("sendFlowEvent");
+        apiClient.sendFlowEvent(flowEvent == FLOW_EVENT_LEAK ? "leak" : "noFlow", flowEventRate.load(), flowEventTime.load());
+      }
+
       if(flagSendFlow.load())
       {
         flagSendFlow.store(false);
         Serial.println("sendFlow");
+        Serial.print("flowRate:"); // debug
+        Serial.println(flowAnalytics.getFlowRate()); // debug
         double waterVolume = sensorsDevices.getWaterVolume();
         apiClient.sendWaterVolume(waterVolume);
         sensorsDevices.resetWaterVolume();
+        flowTotalizer.stage(); // next checkpoint persists the new event baseline
       }
       
       if(flagSendSensors.load())
       {
         flagSendSensors.store(false);
-        
-        if(xSemaphoreTake(xMutexSensorData, portMAX_DELAY))
-        {
-          Serial.println("sendSensors");
-          apiClient.sendAllSensorsData(humiSensors, tempSensors, numModules, numModules);
-          xSemaphoreGive(xMutexSensorData);
-        }
+        Serial.println("sendSensors");
+        sendSensorsData(); // queued when the endpoint is backing off
       }
 
-      if(flagScheduleCheck.load() || inconsistentIrrigationSchedules)
+      if(mqttTransport.takeScheduleChanged()) flagScheduleCheck.store(true);
+
+      // offline the fetch fails before the request engine sees it, no backoff would slow the retries
+      if((flagScheduleCheck.load() || inconsistentIrrigationSchedules) && apiClient.isOnline() && apiClient.isEndpointReady(ENDPOINT_TIME_VALVE))
       {
-        flagScheduleCheck.store(false);
+        bool schedulesReceived;
 
-        if(inconsistentIrrigationSchedules) xTimerReset(irrigationScheduleUpdateTimer, 0);
-        inconsistentIrrigationSchedules = false;      
+        if(inconsistentIrrigationSchedules) 
+        {
+          xTimerReset(irrigationScheduleUpdateTimer, 0);
+          apiClient.forceRefresh(ENDPOINT_TIME_VALVE); // local copy may be stale, download even if the etag matches
+        }
+
+        dataManager.clearSchedulesArray(irrigationSchedulesApi); // apiTask only, fetched without xMutexIrrigationData
+        schedulesReceived = apiClient.searchForIrrigationTime(irrigationSchedulesApi, schedulesChanged);
+        if(schedulesReceived)
+        {
+          flagScheduleCheck.store(false);
+          inconsistentIrrigationSchedules = false;
+          Serial.println(schedulesChanged ? "api_irrigationSchedules" : "api_irrigationSchedules_notModified");
+        }
+        else
+        {
+          Serial.println("irrigationSchedules_retry"); // pending until the endpoint backoff expires
+        }
         
-        if(xSemaphoreTake(xMutexIrrigationData, portMAX_DELAY))
+        if(schedulesReceived && schedulesChanged && xSemaphoreTake(xMutexIrrigationData, portMAX_DELAY))
+        {
+          if(dataManager.compareAndStoreIrrigationSchedulesData(irrigationSchedulesNvs, irrigationSchedulesApi)) compileSchedules();
+          xSemaphoreGive(xMutexIrrigationData);
+        }
+
+        if(schedulesReceived)
         {
-          dataManager.clearSchedulesArray(irrigationSchedulesApi);
-          if(apiClient.searchForIrrigationTime(irrigationSchedulesApi))
+          struct tm localNow;
+          if(timeService.localTime(localNow))
           {
-            Serial.println("api_irrigationSchedules");
-            dataManager.compareAndStoreIrrigationSchedulesData(irrigationSchedulesNvs, irrigationSchedulesApi);
+            Serial.print("Time:"); //debug
+            Serial.print(localNow.tm_hour);//debug
+            Serial.print(":"); //debug
+            Serial.println(localNow.tm_min); //debug
           }
-          
-          Serial.print("Time:"); //debug
-          Serial.print(currentTime.tm_hour);//debug
-          Serial.print(":"); //debug
-          Serial.println(currentTime.tm_min); //debug
-
-          Serial.println("uptadeTime"); //debug
-
-          apiClient.loadWebTime(); 
-          hourUnavailable.store(!getLocalTime(&currentTime, 5000));
-          
-          Serial.print("New time:"); //debug
-          Serial.print(currentTime.tm_hour); //debug
-          Serial.print(":"); //debug
-          Serial.println(currentTime.tm_min); //debug
-
-          xSemaphoreGive(xMutexIrrigationData);
+          Serial.print("timeQuality:"); //debug
+          Serial.println(timeService.getQuality()); //debug
+          Serial.print("timeDrift:"); //debug
+          Serial.println(timeService.getDriftPpm()); //debug
         }
       }
+
+      bool valvePollDue = flagCheckValveStatusApi.load() && apiClient.isEndpointReady(ENDPOINT_VALVE_STATE);
+      if(!valvePollDue && offlineQueue.size() > 0) // backlog only when no valve poll is due
+      {
+        apiClient.drainOfflineQueue(maxQueueDrainRecords);
+      }
+
+      // whatever was pending went out in this window, a missing or stale clock keeps the radio on until sntp answers
+      if(radioPowerMode == RADIO_DUTY_CYCLED && timeService.getQuality() == TIME_SYNCED) apiClient.turnOffWifi();
       xSemaphoreGive(xMutexCriticalApiSend);
     }
-    vTaskDelay(referenceDelay);
+    ulTaskNotifyTake(pdTRUE, tickDelay); // mqtt commands end the wait early
   }
 }
 
@@ -408,41 +601,184 @@ void timerCallbackValveState(TimerHandle_t xTimer)
   flagCheckValveStatusApi.store(true);
 }
 
+void timerCallbackFlowSample(TimerHandle_t xTimer)
+{
+  flowTotalizer.stage();
+  flowAnalytics.addSample(sensorsDevices.getTotalPulses(), millis());
+
+  FlowEvent event = flowAnalytics.takeEvent();
+  switch(event)
+  {
+    case FLOW_EVENT_LEAK:
+      Serial.println("flowLeak");
+      flagSendFlow.store(true); // the leaked volume goes as its own report
+    break;
+
+    case FLOW_EVENT_NO_FLOW:
+      Serial.println("flowMissing");
+    break;
+
+    default:
+    return;
+  }
+
+  time_t epoch;
+  flowEventTime.store(timeService.now(epoch) ? (uint32_t)epoch : 0);
+  flowEventRate.store(flowAnalytics.getFlowRate());
+  pendingFlowEvent.store(event); // apiTask reports it on its next tick
+}
+
 bool checkValveStatusIrrigationSchedules()
 {
-  getLocalTime(&currentTime, 5000);
+  struct tm currentTime;
+
+  if(!timeService.localTime(currentTime)) return false; // no clock, valve stays closed
   
   Serial.print("getLocalTime:"); // debug
   Serial.print(currentTime.tm_hour); // debug
   Serial.print(":"); // debug
   Serial.println(currentTime.tm_min); // debug
 
-  int currentTimeMinutes = currentTime.tm_hour * 60 + currentTime.tm_min;
+  return scheduleIndex.isActive(currentTime.tm_wday, currentTime.tm_hour * 60 + currentTime.tm_min);
+}
+
+void compileSchedules()
+{
+  scheduleIndex.compile(irrigationSchedulesNvs, maxIrrigationSlots);
+  if(valveTaskHandle != nullptr) xTaskNotifyGive(valveTaskHandle); // the next edge may have moved
+
+  struct tm localNow;
+  if(timeService.localTime(localNow))
+  {
+    Serial.print("scheduleMinutesToday:"); // debug
+    Serial.println(scheduleIndex.getActiveMinutes(localNow.tm_wday)); // debug
+  }
+}
 
-  for (int i = 0; i < maxIrrigationSlots; i++)
+void filterSensorReadings(Sensor sensors[], SensorHistory history[], WindowAggregate aggregate[], int numSensors, uint32_t timestamp)
+{
+  for(int i = 0; i < numSensors; i++)
   {
-    int initialTimeMinutes = irrigationSchedulesNvs[i].initialTime.tm_hour * 60 + irrigationSchedulesNvs[i].initialTime.tm_min;
-    int finalTimeMinutes = irrigationSchedulesNvs[i].finalTime.tm_hour * 60 + irrigationSchedulesNvs[i].finalTime.tm_min;
+    if(sensors[i].sensorValue == DEVICE_DISCONNECTED_C) continue; // keep reporting the fault, not a stale average
 
-    if (!(initialTimeMinutes == 0 && finalTimeMinutes == 0))
+    aggregate[i].add(sensors[i].sensorValue);
+    history[i].add(sensors[i].sensorValue, timestamp);
+    sensors[i].sensorValue = history[i].filtered();
+  }
+}
+
+bool sendSensorsData()
+{
+  Sensor humiSnapshot[numModules], tempSnapshot[numModules];
+  WindowAggregate humiWindow[numModules], tempWindow[numModules];
+  bool includeHumi[numModules], includeTemp[numModules];
+  bool *humiMask = nullptr, *tempMask = nullptr;
+  uint32_t now = millis();
+  bool sent;
+
+  if(!xSemaphoreTake(xMutexSensorData, portMAX_DELAY)) return false;
+  for(int i = 0; i < numModules; i++)
+  {
+    humiSnapshot[i] = humiSensors[i];
+    tempSnapshot[i] = tempSensors[i];
+    humiWindow[i] = humiAggregate[i];
+    tempWindow[i] = tempAggregate[i];
+    humiAggregate[i].reset();
+    tempAggregate[i].reset();
+  }
+  xSemaphoreGive(xMutexSensorData);
+
+  if(deadbandUpload)
+  {
+    humiMask = includeHumi;
+    tempMask = includeTemp;
+
+    int numChanged = selectChangedSensors(humiSnapshot, humiDeadband, includeHumi, numModules, now);
+    numChanged += selectChangedSensors(tempSnapshot, tempDeadband, includeTemp, numModules, now);
+
+    if(numChanged == 0)
     {
-      if (finalTimeMinutes < initialTimeMinutes)
-      {
-        if (currentTimeMinutes >= initialTimeMinutes || currentTimeMinutes < finalTimeMinutes)
-        {
-          return true;
-        }
-      }
-      else
-      {
-        if (currentTimeMinutes >= initialTimeMinutes && currentTimeMinutes < finalTimeMinutes)
-        {
-          return true;
-        }
-      }
+      Serial.println("sensorsUnchanged");
+      mergeBackWindows(humiWindow, tempWindow, nullptr, nullptr);
+      return true;
     }
   }
-  return false;
+
+  if(sensorUploadMode == UPLOAD_SNAPSHOT)
+  {
+    sent = apiClient.sendAllSensorsData(humiSnapshot, tempSnapshot, numModules, numModules, humiMask, tempMask);
+  }
+  else
+  {
+    sent = apiClient.sendAggregatedSensorsData(humiSnapshot, tempSnapshot, humiWindow, tempWindow, numModules, numModules, humiMask, tempMask);
+  }
+
+  if(!sent) 
+  {
+    mergeBackWindows(humiWindow, tempWindow, nullptr, nullptr); // neither posted nor queued
+    return false;
+  }
+
+  if(deadbandUpload)
+  {
+    mergeBackWindows(humiWindow, tempWindow, includeHumi, includeTemp); // suppressed channels keep their samples
+    markSensorsSent(humiSnapshot, humiDeadband, includeHumi, numModules, now);
+    markSensorsSent(tempSnapshot, tempDeadband, includeTemp, numModules, now);
+    
+    uint32_t readingsSent = 0, readingsSuppressed = 0;
+    for(int i = 0; i < numModules; i++)
+    {
+      readingsSent += humiDeadband[i].getSentCount() + tempDeadband[i].getSentCount();
+      readingsSuppressed += humiDeadband[i].getSuppressedCount() + tempDeadband[i].getSuppressedCount();
+    }
+    Serial.print("readingsSent:"); // debug
+    Serial.print(readingsSent); // debug
+    Serial.print(" suppressed:"); // debug
+    Serial.println(readingsSuppressed); // debug
+  }
+  return true;
+}
+
+void mergeBackWindows(WindowAggregate humiWindow[], WindowAggregate tempWindow[], const bool sentHumi[], const bool sentTemp[])
+{
+  if(!xSemaphoreTake(xMutexSensorData, portMAX_DELAY)) return;
+  for(int i = 0; i < numModules; i++)
+  {
+    if(sentHumi == nullptr || !sentHumi[i]) humiAggregate[i].merge(humiWindow[i]);
+    if(sentTemp == nullptr || !sentTemp[i]) tempAggregate[i].merge(tempWindow[i]);
+  }
+  xSemaphoreGive(xMutexSensorData);
+}
+
+int selectChangedSensors(Sensor sensors[], DeadbandFilter deadband[], bool include[], int numSensors, uint32_t now)
+{
+  int numChanged = 0;
+
+  for(int i = 0; i < numSensors; i++)
+  {
+    include[i] = deadband[i].shouldSend(sensors[i].sensorValue, now);
+    if(include[i]) numChanged++;
+  }
+  return numChanged;
+}
+
+void markSensorsSent(Sensor sensors[], DeadbandFilter deadband[], bool include[], int numSensors, uint32_t now)
+{
+  for(int i = 0; i < numSensors; i++)
+  {
+    if(include[i]) deadband[i].markSent(sensors[i].sensorValue, now);
+  }
+}
+
+void loadTempProbes()
+{
+  TempProbeTable probeTable = {};
+
+  if(dataManager.loadTempProbesData(probeTable) && sensorsDevices.setTempProbes(probeTable)) return;
+
+  Serial.println("tempProbes_discovery");
+  sensorsDevices.discoverTempProbes(probeTable);
+  if(!dataManager.storeTempProbesData(probeTable)) Serial.println("nvs_fail");
 }
 
 void settings()
@@ -560,4 +896,13 @@ void settings()
       break;
     }  
   }
-}
\ No newline at end of file
+}
+
+bool radioWindowDue(bool inconsistentSchedules)
+{
+  bool valvePollDue = flagCheckValveStatusApi.load() && apiClient.isEndpointReady(ENDPOINT_VALVE_STATE);
+  bool scheduleRepairDue = inconsistentSchedules && apiClient.isEndpointReady(ENDPOINT_TIME_VALVE);
+  bool timeSyncDue = timeService.getQuality() != TIME_SYNCED;
+
+  return valvePollDue || flagSendFlow.load() || pendingFlowEvent.load() != FLOW_EVENT_NONE || scheduleRepairDue || timeSyncDue;
+}